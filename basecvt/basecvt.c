@@ -27,6 +27,8 @@
 /* --- System Headers --- */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <ctype.h>
 #include <locale.h>
 
@@ -34,42 +36,906 @@
 
 /* --- Local Headers --- */
 
+#include "bignum.h"
+
 /* --- Macros --- */
 
 #define DFL_INPUT_BASE 16
 #define DFL_OUTPUT_BASE 10
 
+#define LINEBUFSZ 256
+#define BLOCKSZ (1024 * 1024)
+#define OUTBUFSZ (256 * 1024)
+
+#define NO_DIGIT 0xFF
+
+#define MAX_OUTPUTS 36
+#define MAX_WIDTH 128
+#define MAX_FIELDS MAX_WIDTH
+
 #define HEADER "basecvt v" VERSION " - Mark Lindner"
-#define USAGE "[ -i <base> ] [ -o <base> ] [ -h ]"
+#define USAGE "[ -i <base> ] [ -o <base>[,<base>...] ] " \
+  "[ -w <width> [ -f <fields> ] ] [ -b ] [ -h ]"
+
+/* --- Types --- */
+
+/* Conversion state. */
+
+typedef struct
+{
+  char *obuf;     /* output buffer */
+  size_t olen;
+  bignum_t val;   /* for values beyond the 64-bit kernels */
+  bignum_t field;
+  char *fbuf;     /* formatting buffer for bignums */
+  size_t fbufsz;
+} converter_t;
 
 /* --- File Scope Variables --- */
 
-static const char *digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static int base_in = DFL_INPUT_BASE;
+static int bases_out[MAX_OUTPUTS] = { DFL_OUTPUT_BASE };
+static unsigned int nbases_out = 1;
+
+/* fixed-width mode: the width in bits (0 if not in effect), and the widths
+ * of the bit fields to display, most significant first
+ */
+
+static unsigned int width = 0, fields[MAX_FIELDS], nfields = 0;
 
-static int base_in = DFL_INPUT_BASE, base_out = DFL_OUTPUT_BASE;
+static const char *digit_chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static const char *digit_pairs =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static unsigned char digit_vals[256];
+static char hex_pairs[512];
+static size_t u64_digits[37];
 
 /* --- Functions --- */
 
 static void print_bases(void)
 {
-  printf("Input Base: %d, Output Base: %d\n\n", base_in, base_out);
+  unsigned int i;
+
+  printf("Input Base: %d, Output Base%s: ", base_in,
+         (nbases_out > 1) ? "s" : "");
+
+  for(i = 0; i < nbases_out; ++i)
+    printf("%s%d", (i > 0) ? ", " : "", bases_out[i]);
+
+  if(width > 0)
+    printf(", Width: %u", width);
+  printf("\n\n");
+}
+
+/* Read a line of any length into *buf, which is grown as needed, and strip
+ * the trailing newline. Returns FALSE at end of input.
+ */
+
+static c_bool_t read_line(FILE *fp, char **buf, size_t *bufsz)
+{
+  size_t len = 0;
+
+  for(;;)
+  {
+    if(*bufsz - len < 2)
+    {
+      *bufsz *= 2;
+      *buf = C_realloc(*buf, *bufsz, char);
+    }
+
+    if(!fgets(*buf + len, (int)(*bufsz - len), fp))
+      break;
+
+    len += strlen(*buf + len);
+    if((*buf)[len - 1] == '\n')
+    {
+      (*buf)[--len] = '\0';
+      return(TRUE);
+    }
+  }
+
+  (*buf)[len] = '\0';
+  return(len > 0);
+}
+
+/*
+ */
+
+static void init_tables(void)
+{
+  int i;
+
+  memset(digit_vals, NO_DIGIT, sizeof(digit_vals));
+
+  for(i = 0; i < 36; ++i)
+  {
+    digit_vals[(unsigned char)digit_chars[i]] = i;
+    digit_vals[tolower((unsigned char)digit_chars[i])] = i;
+  }
+
+  for(i = 0; i < 256; ++i)
+  {
+    hex_pairs[2 * i] = digit_chars[i >> 4];
+    hex_pairs[(2 * i) + 1] = digit_chars[i & 0xF];
+  }
+
+  /* the number of digits in each base that always fit in 64 bits */
+
+  for(i = 2; i <= 36; ++i)
+  {
+    uint64_t p = 1;
+
+    while(p <= (UINT64_MAX / i))
+      p *= i, ++u64_digits[i];
+
+    if(p == (UINT64_MAX / i) + 1) /* base^(d+1) is exactly 2^64 */
+      ++u64_digits[i];
+  }
+}
+
+/* Convert n digits to a 64-bit value, one digit at a time. The caller
+ * passes a constant base for the common cases so that each gets its own
+ * inlined loop.
+ */
+
+static uint64_t parse_u64(const char *s, size_t n, int base)
+{
+  uint64_t v = 0;
+
+  while(n-- > 0)
+    v = (v * base) + digit_vals[(unsigned char)*s++];
+
+  return(v);
+}
+
+#ifndef WORDS_BIGENDIAN
+
+/* SWAR ("SIMD within a register") conversion of 8 digits at a time. The
+ * digits are loaded into one 64-bit word, first digit in the low byte, and
+ * reduced to per-byte values; adjacent lanes are then merged pairwise, so
+ * that 8 one-byte lanes become 4 two-byte lanes, then 2 four-byte lanes,
+ * then one value.
+ */
+
+static uint64_t load8(const char *s)
+{
+  uint64_t v;
+
+  memcpy(&v, s, sizeof(v));
+  return(v);
+}
+
+/* Merge 8 lanes of k-bit values in a power-of-two base.
+ */
+
+static uint64_t swar_merge_pow2(uint64_t v, int k)
+{
+  v = ((v << k) | (v >> 8)) & 0x00FF00FF00FF00FFULL;
+  v = ((v << (2 * k)) | (v >> 16)) & 0x0000FFFF0000FFFFULL;
+  v = ((v << (4 * k)) | (v >> 32)) & 0xFFFFFFFFULL;
+
+  return(v);
+}
+
+/*
+ */
+
+static uint64_t swar_dec8(const char *s)
+{
+  uint64_t v = load8(s) - 0x3030303030303030ULL;
+
+  v = ((v * 10) + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+  v = ((v * 100) + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+  v = ((v * 10000) + (v >> 32)) & 0xFFFFFFFFULL;
+
+  return(v);
+}
+
+/* Hex digits are mapped to their values without a table: the low nibble of
+ * '0'-'9' is the value, and the letters, which have bit 6 set, need 9 added
+ * to their low nibble.
+ */
+
+static uint64_t swar_hex8(const char *s)
+{
+  uint64_t v = load8(s);
+
+  v = (v & 0x0F0F0F0F0F0F0F0FULL) + (9 * ((v >> 6) & 0x0101010101010101ULL));
+
+  return(swar_merge_pow2(v, 4));
+}
+
+/*
+ */
+
+static uint64_t swar_pow2_8(const char *s, int k)
+{
+  return(swar_merge_pow2(load8(s) - 0x3030303030303030ULL, k));
+}
+
+#endif /* WORDS_BIGENDIAN */
+
+/* Convert n digits to a 64-bit value, using the fastest kernel for the
+ * base. Building with SCALAR_KERNELS defined sends every base through the
+ * one-digit-at-a-time loops instead, as a baseline for benchmarking.
+ */
+
+static uint64_t parse_u64_any(const char *s, size_t n, int base)
+{
+  uint64_t v = 0;
+
+#ifdef SCALAR_KERNELS
+  return(parse_u64(s, n, base));
+#endif
+
+  switch(base)
+  {
+#ifndef WORDS_BIGENDIAN
+    case 2:
+      for(; n >= 8; s += 8, n -= 8)
+        v = (v << 8) | swar_pow2_8(s, 1);
+      return((v << n) | parse_u64(s, n, 2));
+
+    case 8:
+      for(; n >= 8; s += 8, n -= 8)
+        v = (v << 24) | swar_pow2_8(s, 3);
+      return((v << (3 * n)) | parse_u64(s, n, 8));
+
+    case 10:
+      for(; n >= 8; s += 8, n -= 8)
+        v = (v * 100000000) + swar_dec8(s);
+      for(; n > 0; --n)
+        v = (v * 10) + digit_vals[(unsigned char)*s++];
+      return(v);
+
+    case 16:
+      for(; n >= 8; s += 8, n -= 8)
+        v = (v << 32) | swar_hex8(s);
+      return((v << (4 * n)) | parse_u64(s, n, 16));
+#else
+    case 2:
+      return(parse_u64(s, n, 2));
+    case 8:
+      return(parse_u64(s, n, 8));
+    case 10:
+      return(parse_u64(s, n, 10));
+    case 16:
+      return(parse_u64(s, n, 16));
+#endif /* WORDS_BIGENDIAN */
+
+    default:
+      return(parse_u64(s, n, base));
+  }
+}
+
+/* Format a 64-bit value backwards from end, one digit at a time, returning
+ * a pointer to the first digit.
+ */
+
+static char *format_u64(uint64_t v, int base, char *end)
+{
+  do
+  {
+    *--end = digit_chars[v % base];
+    v /= base;
+  }
+  while(v > 0);
+
+  return(end);
+}
+
+/* Decimal is formatted two digits per division, from a table of pairs.
+ */
+
+static char *format_dec(uint64_t v, char *end)
+{
+  while(v >= 100)
+  {
+    end -= 2;
+    memcpy(end, digit_pairs + (2 * (v % 100)), 2);
+    v /= 100;
+  }
+
+  if(v >= 10)
+  {
+    end -= 2;
+    memcpy(end, digit_pairs + (2 * v), 2);
+  }
+  else
+    *--end = '0' + (char)v;
+
+  return(end);
+}
+
+/* Hex is formatted a byte (two digits) at a time, from a table.
+ */
+
+static char *format_hex(uint64_t v, char *end)
+{
+  while(v >= 0x100)
+  {
+    end -= 2;
+    memcpy(end, hex_pairs + (2 * (v & 0xFF)), 2);
+    v >>= 8;
+  }
+
+  if(v >= 0x10)
+  {
+    end -= 2;
+    memcpy(end, hex_pairs + (2 * v), 2);
+  }
+  else
+    *--end = digit_chars[v];
+
+  return(end);
+}
+
+#ifndef WORDS_BIGENDIAN
+
+/* Binary is formatted a byte (eight digits) at a time: a multiplication
+ * spreads the 8 bits of a byte into the low bits of 8 byte lanes, in
+ * most-significant-first order.
+ */
+
+static char *format_bin(uint64_t v, char *end)
+{
+  char *p;
+
+  do
+  {
+    uint64_t d = ((((v & 0xFF) * 0x8040201008040201ULL) >> 7)
+                  & 0x0101010101010101ULL) + 0x3030303030303030ULL;
+
+    end -= 8;
+    memcpy(end, &d, 8);
+    v >>= 8;
+  }
+  while(v > 0);
+
+  for(p = end; (*p == '0') && (p < end + 7); ++p);
+
+  return(p);
+}
+
+#endif /* WORDS_BIGENDIAN */
+
+/* Format a 64-bit value with the fastest kernel for the base, or, with
+ * SCALAR_KERNELS, one digit at a time.
+ */
+
+static char *format_u64_any(uint64_t v, int base, char *end)
+{
+#ifdef SCALAR_KERNELS
+  return(format_u64(v, base, end));
+#endif
+
+  switch(base)
+  {
+    case 2:
+#ifndef WORDS_BIGENDIAN
+      return(format_bin(v, end));
+#else
+      return(format_u64(v, 2, end));
+#endif
+    case 8:
+      return(format_u64(v, 8, end));
+    case 10:
+      return(format_dec(v, end));
+    case 16:
+      return(format_hex(v, end));
+    default:
+      return(format_u64(v, base, end));
+  }
+}
+
+/*
+ */
+
+static void conv_init(converter_t *c)
+{
+  c->obuf = C_malloc(OUTBUFSZ, char);
+  c->olen = 0;
+  bn_init(&(c->val));
+  bn_init(&(c->field));
+  c->fbuf = NULL;
+  c->fbufsz = 0;
+}
+
+/*
+ */
+
+static void conv_free(converter_t *c)
+{
+  C_free(c->obuf);
+  C_free(c->fbuf);
+  bn_free(&(c->val));
+  bn_free(&(c->field));
+}
+
+/*
+ */
+
+static c_bool_t out_flush(converter_t *c)
+{
+  c_bool_t ok = (fwrite(c->obuf, 1, c->olen, stdout) == c->olen);
+
+  c->olen = 0;
+  return(ok);
+}
+
+/*
+ */
+
+static c_bool_t out_write(converter_t *c, const char *s, size_t len)
+{
+  if(c->olen + len > OUTBUFSZ)
+  {
+    if(!out_flush(c))
+      return(FALSE);
+
+    if(len > OUTBUFSZ)
+      return(fwrite(s, 1, len, stdout) == len);
+  }
+
+  memcpy(c->obuf + c->olen, s, len);
+  c->olen += len;
+
+  return(TRUE);
+}
+
+/* Write a formatted value, zero-padded on the left to ndig digits.
+ */
+
+static c_bool_t out_padded(converter_t *c, const char *s, size_t len,
+                           size_t ndig)
+{
+  static const char zeros[] = "0000000000000000";
+
+  while(len < ndig)
+  {
+    size_t n = ndig - len;
+
+    if(n > sizeof(zeros) - 1)
+      n = sizeof(zeros) - 1;
+
+    if(!out_write(c, zeros, n))
+      return(FALSE);
+
+    ndig -= n;
+  }
+
+  return(out_write(c, s, len));
+}
+
+/* The number of digits needed to show every bit of a bits-wide pattern in
+ * the given base, if that is a power of two; otherwise 0, as patterns in
+ * other bases are not padded.
+ */
+
+static size_t pattern_digits(unsigned int bits, int base)
+{
+  int k = bn_pow2_bits(base);
+
+  return(k ? ((bits + k - 1) / k) : 0);
+}
+
+/* Write a w-bit two's-complement pattern in each output base: as its bit
+ * fields, if any were given; as the padded pattern itself in a power-of-two
+ * base; and otherwise as a signed value. The width is passed as a constant
+ * by conv_fixed(), so that each width gets its own specialized copy.
+ */
+
+static c_bool_t out_fixed(converter_t *c, uint64_t v, unsigned int w)
+{
+  char tmp[66], *s, *end = tmp + sizeof(tmp);
+  unsigned int b;
+
+  for(b = 0; b < nbases_out; ++b)
+  {
+    int base = bases_out[b];
+
+    if((b > 0) && !out_write(c, " ", 1))
+      return(FALSE);
+
+    if(nfields > 0)
+    {
+      unsigned int i, pos = w;
+
+      for(i = 0; i < nfields; ++i)
+      {
+        uint64_t f;
+
+        pos -= fields[i];
+        f = (v >> pos) & (((fields[i] < 64) ? (1ULL << fields[i]) : 0) - 1);
+
+        s = format_u64_any(f, base, end);
+        if(((i > 0) && !out_write(c, ":", 1))
+           || !out_padded(c, s, end - s, pattern_digits(fields[i], base)))
+          return(FALSE);
+      }
+    }
+    else if(bn_pow2_bits(base))
+    {
+      s = format_u64_any(v, base, end);
+      if(!out_padded(c, s, end - s, pattern_digits(w, base)))
+        return(FALSE);
+    }
+    else
+    {
+      if((v >> (w - 1)) & 1)
+      {
+        /* negative */
+
+        s = format_u64_any((~v + 1) & (((w < 64) ? (1ULL << w) : 0) - 1),
+                           base, end);
+        *--s = '-';
+      }
+      else
+        s = format_u64_any(v, base, end);
+
+      if(!out_write(c, s, end - s))
+        return(FALSE);
+    }
+  }
+
+  return(TRUE);
+}
+
+/* Reduce a parsed value to w bits and write it. The value has been parsed
+ * modulo 2^64, which is exact in every width up to 64.
+ */
+
+static c_bool_t conv_fixed(converter_t *c, uint64_t v, c_bool_t neg)
+{
+  if(neg)
+    v = ~v + 1;
+
+  switch(width)
+  {
+    case 8:
+      return(out_fixed(c, v & 0xFF, 8));
+    case 16:
+      return(out_fixed(c, v & 0xFFFF, 16));
+    case 32:
+      return(out_fixed(c, v & 0xFFFFFFFFULL, 32));
+    default:
+      return(out_fixed(c, v, 64));
+  }
 }
 
+/* As above, for widths beyond 64 bits, using bignums.
+ */
+
+static c_bool_t conv_fixed_big(converter_t *c)
+{
+  size_t len;
+  unsigned int b;
+
+  bn_twos(&(c->val), width);
+
+  for(b = 0; b < nbases_out; ++b)
+  {
+    int base = bases_out[b];
+
+    if((b > 0) && !out_write(c, " ", 1))
+      return(FALSE);
+
+    if(nfields > 0)
+    {
+      unsigned int i, pos = width;
+
+      for(i = 0; i < nfields; ++i)
+      {
+        pos -= fields[i];
+        bn_bits(&(c->field), &(c->val), pos, fields[i]);
+
+        len = bn_format(&(c->field), base, &(c->fbuf), &(c->fbufsz));
+        if(((i > 0) && !out_write(c, ":", 1))
+           || !out_padded(c, c->fbuf, len, pattern_digits(fields[i], base)))
+          return(FALSE);
+      }
+    }
+    else if(bn_pow2_bits(base) || !bn_testbit(&(c->val), width - 1))
+    {
+      len = bn_format(&(c->val), base, &(c->fbuf), &(c->fbufsz));
+      if(!out_padded(c, c->fbuf, len, pattern_digits(width, base)))
+        return(FALSE);
+    }
+    else
+    {
+      /* negative: the value is -(2^w - pattern) */
+
+      bn_bits(&(c->field), &(c->val), 0, width);
+      c->field.neg = TRUE;
+      bn_twos(&(c->field), width);
+      c->field.neg = TRUE;
+
+      len = bn_format(&(c->field), base, &(c->fbuf), &(c->fbufsz));
+      if(!out_write(c, c->fbuf, len))
+        return(FALSE);
+    }
+  }
+
+  return(TRUE);
+}
+
+/* Convert one token: an optional sign, an optional "0x" in base 16, and
+ * digits, with anything following the digits ignored. The value is parsed
+ * once and then formatted in each output base. Values that fit in 64 bits
+ * are converted with the fixed-base kernels above; larger ones fall back to
+ * the bignum engine.
+ */
+
+static c_bool_t conv_token(converter_t *c, const char *p, const char *end)
+{
+  const char *d;
+  c_bool_t neg = FALSE;
+  size_t n, len;
+  unsigned int b;
+
+  if((*p == '-') || (*p == '+'))
+    neg = (*p++ == '-');
+
+  if((base_in == 16) && ((end - p) > 2) && (p[0] == '0')
+     && ((p[1] == 'x') || (p[1] == 'X'))
+     && (digit_vals[(unsigned char)p[2]] < 16))
+    p += 2;
+
+  for(d = p; (d < end) && (digit_vals[(unsigned char)*d] < base_in); ++d);
+  n = d - p;
+
+  if((width > 0) && (width <= 64))
+  {
+    /* the kernels parse any number of digits modulo 2^64 */
+
+    return(conv_fixed(c, parse_u64_any(p, n, base_in), neg));
+  }
+  else if((width == 0) && (n <= u64_digits[base_in]))
+  {
+    char tmp[66], *s;
+    uint64_t v = parse_u64_any(p, n, base_in);
+
+    for(b = 0; b < nbases_out; ++b)
+    {
+      s = format_u64_any(v, bases_out[b], tmp + sizeof(tmp));
+      if(neg && (v != 0))
+        *--s = '-';
+
+      if(((b > 0) && !out_write(c, " ", 1))
+         || !out_write(c, s, tmp + sizeof(tmp) - s))
+        return(FALSE);
+    }
+
+    return(TRUE);
+  }
+
+  bn_set_digits(&(c->val), p, n, base_in, neg);
+  if(width > 0)
+    return(conv_fixed_big(c));
+
+  for(b = 0; b < nbases_out; ++b)
+  {
+    len = bn_format(&(c->val), bases_out[b], &(c->fbuf), &(c->fbufsz));
+
+    if(((b > 0) && !out_write(c, " ", 1)) || !out_write(c, c->fbuf, len))
+      return(FALSE);
+  }
+
+  return(TRUE);
+}
+
+/* Convert the tokens on one line (excluding its newline), writing them
+ * separated by single spaces. With several output bases, each token is
+ * instead written on a line of its own, as its conversions separated by
+ * single spaces.
+ */
+
+static c_bool_t conv_line(converter_t *c, const char *p, const char *end)
+{
+  c_bool_t first = TRUE, multi = (nbases_out > 1);
+
+  for(;;)
+  {
+    const char *tok;
+
+    while((p < end) && isspace((unsigned char)*p))
+      ++p;
+
+    if(p == end)
+      break;
+
+    for(tok = p; (p < end) && !isspace((unsigned char)*p); ++p);
+
+    if(!first && !multi && !out_write(c, " ", 1))
+      return(FALSE);
+
+    if(!conv_token(c, tok, p))
+      return(FALSE);
+
+    if(multi && !out_write(c, "\n", 1))
+      return(FALSE);
+
+    first = FALSE;
+  }
+
+  return(multi || out_write(c, "\n", 1));
+}
+
+/* Convert all of standard input to standard output. Input is read in large
+ * blocks and converted a whole line at a time; a partial line at the end of
+ * a block is moved to the front and completed by the next read, the block
+ * being enlarged if a single line does not fit.
+ */
+
+static c_bool_t batch(void)
+{
+  converter_t c;
+  char *ibuf;
+  size_t icap = BLOCKSZ, ilen = 0, n, pos;
+  c_bool_t ok = TRUE, eof = FALSE;
+
+  ibuf = C_malloc(icap, char);
+  conv_init(&c);
+
+  while(ok && !eof)
+  {
+    if(icap - ilen < BLOCKSZ)
+    {
+      icap *= 2;
+      ibuf = C_realloc(ibuf, icap, char);
+    }
+
+    n = fread(ibuf + ilen, 1, icap - ilen, stdin);
+    if(n == 0)
+    {
+      if(ferror(stdin))
+        ok = FALSE;
+
+      eof = TRUE;
+    }
+
+    ilen += n;
+    pos = 0;
+
+    while(ok)
+    {
+      const char *nl = memchr(ibuf + pos, '\n', ilen - pos);
+
+      if(!nl)
+      {
+        /* last line is missing its newline */
+
+        if(eof && (pos < ilen))
+        {
+          ok = conv_line(&c, ibuf + pos, ibuf + ilen);
+          pos = ilen;
+        }
+
+        break;
+      }
+
+      ok = conv_line(&c, ibuf + pos, nl);
+      pos = nl - ibuf + 1;
+    }
+
+    memmove(ibuf, ibuf + pos, ilen - pos);
+    ilen -= pos;
+  }
+
+  if(ok)
+    ok = out_flush(&c);
+
+  C_free(ibuf);
+  conv_free(&c);
+
+  return(ok);
+}
+
+/* Parse a comma-separated list of output bases. The current list is
+ * replaced only if the whole list is valid.
+ */
+
+static c_bool_t parse_bases(const char *s)
+{
+  int bases[MAX_OUTPUTS];
+  unsigned int n;
+  char *e;
+
+  for(n = 0; n < MAX_OUTPUTS; ++n)
+  {
+    long x = strtol(s, &e, 10);
+
+    if((e == s) || (x < 2) || (x > 36))
+      break;
+
+    bases[n] = (int)x;
+
+    while(isspace((unsigned char)*e))
+      ++e;
+
+    if(*e == '\0')
+    {
+      nbases_out = n + 1;
+      memcpy(bases_out, bases, nbases_out * sizeof(int));
+      return(TRUE);
+    }
+    else if(*e != ',')
+      break;
+
+    s = e + 1;
+  }
+
+  return(FALSE);
+}
+
+/* Parse a comma-separated list of bit field widths, which must add up to
+ * the value width.
+ */
+
+static c_bool_t parse_fields(const char *s)
+{
+  unsigned int total = 0;
+  char *e;
+
+  for(nfields = 0; nfields < MAX_FIELDS; ++nfields)
+  {
+    long x = strtol(s, &e, 10);
+
+    if((e == s) || (x < 1) || (x > MAX_WIDTH))
+      break;
+
+    fields[nfields] = (unsigned int)x;
+    total += x;
+
+    if(*e == '\0')
+    {
+      ++nfields;
+      return(total == width);
+    }
+    else if(*e != ',')
+      break;
+
+    s = e + 1;
+  }
+
+  return(FALSE);
+}
+
+/*
+ */
+
 int main(int argc, char **argv)
 {
   int ch, x;
-  c_bool_t errflag = FALSE;
+  c_bool_t errflag = FALSE, batchmode = FALSE;
   extern char *optarg;
   extern int optind;
-  char buf[256];
+  char *buf, *fieldspec = NULL;
+  size_t bufsz = LINEBUFSZ;
+  converter_t conv;
 
   setlocale(LC_CTYPE, "POSIX");
 
   C_error_init(*argv);
 
-  while((ch = getopt(argc, argv, "hi:o:")) != EOF)
+  while((ch = getopt(argc, argv, "hi:o:bw:f:")) != EOF)
     switch((char)ch)
     {
+      case 'b':
+        batchmode = TRUE;
+        break;
+
       case 'h':
         C_error_printf("%s\n", HEADER);
         C_error_usage(USAGE);
@@ -87,36 +953,76 @@ int main(int argc, char **argv)
         break;
 
       case 'o':
-        x = atoi(optarg);
-        if((x < 2) || (x > 36))
+        if(!parse_bases(optarg))
         {
           C_error_printf("Invalid output base (must be in range [2,36])\n");
           errflag = TRUE;
         }
+        break;
+
+      case 'w':
+        x = atoi(optarg);
+        if((x != 8) && (x != 16) && (x != 32) && (x != 64) && (x != 128))
+        {
+          C_error_printf("Invalid width (must be 8, 16, 32, 64 or 128)\n");
+          errflag = TRUE;
+        }
         else
-          base_out = x;
+          width = x;
+        break;
+
+      case 'f':
+        fieldspec = optarg;
         break;
 
       default:
         errflag = TRUE;
     }
 
+  if(fieldspec && !errflag)
+  {
+    if(width == 0)
+    {
+      C_error_printf("Bit fields require a width (-w)\n");
+      errflag = TRUE;
+    }
+    else if(!parse_fields(fieldspec))
+    {
+      C_error_printf("Invalid bit fields (widths must add up to %u)\n",
+                     width);
+      errflag = TRUE;
+    }
+  }
+
   if(errflag)
   {
     C_error_usage(USAGE);
     exit(EXIT_FAILURE);
   }
 
-  print_bases();
+  init_tables();
 
-  for(;;)
+  if(batchmode)
   {
-    char *p, *e, val[34];
-    int x;
+    c_bool_t ok = batch();
+
+    if(ok && fflush(stdout) != 0)
+      ok = FALSE;
+
+    if(!ok)
+      C_error_syserr();
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  print_bases();
 
-    val[33] = 0;
+  buf = C_newstr(bufsz);
+  conv_init(&conv);
 
-    if(C_io_gets(stdin, buf, sizeof(buf), '\n') == EOF)
+  for(;;)
+  {
+    if(!read_line(stdin, &buf, &bufsz))
       break;
 
     if(buf[0] == '<')
@@ -131,11 +1037,8 @@ int main(int argc, char **argv)
     }
     else if(buf[0] == '>')
     {
-      x = atoi(buf + 1);
-      if((x < 2) || (x > 36))
+      if(!parse_bases(buf + 1))
         C_error_printf("Invalid output base (must be in range [2,36])\n");
-      else
-        base_out = x;
 
       print_bases();
     }
@@ -145,43 +1048,14 @@ int main(int argc, char **argv)
     }
     else
     {
-      for(p = strtok(buf, " ");
-          p;
-          p = strtok(NULL, " "))
-      {
-        c_bool_t neg = FALSE;
-
-        long x = strtol(p, &e, base_in);
-        int i = 33;
-
-        if(x < 0)
-        {
-          neg = TRUE;
-          x = -x;
-
-          if(x < 0) /* overflow */
-          {
-            val[--i] = digits[-(x + base_out) % base_out];
-            x = -(x / base_out);
-          }
-        }
-
-        do
-        {
-          val[--i] = digits[x % base_out];
-          x /= base_out;
-        }
-        while(x > 0);
-
-        if(neg)
-          val[--i] = '-';
-
-        printf("%s ", val + i);
-      }
-      putchar('\n');
+      conv_line(&conv, buf, buf + strlen(buf));
+      out_flush(&conv);
     }
   }
 
+  conv_free(&conv);
+  C_free(buf);
+
   return(EXIT_SUCCESS);
 }
 
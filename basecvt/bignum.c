@@ -0,0 +1,1086 @@
+/* ----------------------------------------------------------------------------
+   basecvt - interactive base converter
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+/* Arbitrary-precision radix conversion.
+ *
+ * Values are parsed and formatted by divide and conquer over a table of
+ * powers of the base, P[j] = P[0]^(2^j), where P[0] is the largest power of
+ * the base that fits in a limb. A string of digits is split so that its low
+ * half has exactly as many digits as some P[j], and the value is then
+ * hi * P[j] + lo; conversely, a value less than P[j+1] is formatted as the
+ * digits of value / P[j] followed by the zero-padded digits of
+ * value % P[j]. Multiplication uses Karatsuba's method, and the divisions
+ * use Barrett reduction with a precomputed reciprocal of each P[j], which
+ * is itself found by Newton iteration. Both conversions therefore take
+ * O(M(n) log n) time, where M(n) is the cost of multiplying two n-limb
+ * numbers, rather than the O(n^2) of digit-at-a-time conversion. Values
+ * in power-of-two bases are simply repacked, bit for bit, in linear time.
+ */
+
+/* --- Feature Test Switches --- */
+
+#include "config.h"
+
+/* --- System Headers --- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <cbase/cbase.h>
+
+/* --- Local Headers --- */
+
+#include "bignum.h"
+
+/* --- Macros --- */
+
+#define LIMB_BITS 32
+
+#define KARATSUBA_THRESHOLD 32 /* limbs; smaller products are schoolbook */
+#define RECIP_THRESHOLD 32     /* limbs; smaller reciprocals by long division */
+#define FORMAT_THRESHOLD 32    /* limbs; smaller values by short division */
+#define PARSE_THRESHOLD 32     /* limbs; smaller values by short multiply */
+
+#define MAX_LEVELS 40
+
+/* --- Types --- */
+
+typedef bn_limb_t limb_t;
+typedef uint64_t dlimb_t;
+
+/* Conversion tables for one base. */
+
+typedef struct
+{
+  int base;
+  int chunk;                  /* digits in P[0] */
+  limb_t big;                 /* P[0] = base^chunk */
+  int nlevels;                /* powers computed so far */
+  bignum_t pow[MAX_LEVELS];   /* P[j] */
+  size_t digits[MAX_LEVELS];  /* number of digits in P[j] - 1 */
+  bignum_t recip[MAX_LEVELS]; /* floor(B^2k / P[j]), where P[j] has k limbs,
+                                 or empty if not yet computed */
+} radix_t;
+
+/* --- File Scope Variables --- */
+
+static const char *digit_chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static radix_t *radixes[37];
+
+static limb_t one_limb = 1;
+static const bignum_t one = { &one_limb, 1, 1, FALSE };
+
+/* --- Functions --- */
+
+void bn_init(bignum_t *x)
+{
+  x->limbs = NULL;
+  x->n = x->cap = 0;
+  x->neg = FALSE;
+}
+
+/*
+ */
+
+void bn_free(bignum_t *x)
+{
+  C_free(x->limbs);
+  bn_init(x);
+}
+
+/*
+ */
+
+static void reserve(bignum_t *x, size_t n)
+{
+  if(n > x->cap)
+  {
+    x->cap = ((n > x->cap * 3 / 2) ? n : x->cap * 3 / 2);
+    x->limbs = C_realloc(x->limbs, x->cap, limb_t);
+  }
+}
+
+/*
+ */
+
+static size_t normalize(const limb_t *a, size_t n)
+{
+  while(n > 0 && a[n - 1] == 0)
+    --n;
+
+  return(n);
+}
+
+/* r = a + b, where an >= bn; r has an limbs and may alias a. Returns the
+ * carry.
+ */
+
+static limb_t add_raw(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                      size_t bn)
+{
+  dlimb_t c = 0;
+  size_t i;
+
+  for(i = 0; i < bn; ++i)
+  {
+    c += (dlimb_t)a[i] + b[i];
+    r[i] = (limb_t)c;
+    c >>= LIMB_BITS;
+  }
+
+  for(; i < an; ++i)
+  {
+    c += a[i];
+    r[i] = (limb_t)c;
+    c >>= LIMB_BITS;
+  }
+
+  return((limb_t)c);
+}
+
+/* r = a - b, where an >= bn; r has an limbs and may alias a. Returns the
+ * borrow.
+ */
+
+static limb_t sub_raw(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                      size_t bn)
+{
+  limb_t borrow = 0;
+  size_t i;
+
+  for(i = 0; i < bn; ++i)
+  {
+    dlimb_t d = (dlimb_t)a[i] - b[i] - borrow;
+    r[i] = (limb_t)d;
+    borrow = (limb_t)(d >> 63);
+  }
+
+  for(; i < an; ++i)
+  {
+    dlimb_t d = (dlimb_t)a[i] - borrow;
+    r[i] = (limb_t)d;
+    borrow = (limb_t)(d >> 63);
+  }
+
+  return(borrow);
+}
+
+/*
+ */
+
+static void mul_school(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                       size_t bn)
+{
+  size_t i, j;
+
+  memset(r, 0, (an + bn) * sizeof(limb_t));
+
+  for(i = 0; i < an; ++i)
+  {
+    dlimb_t c = 0;
+
+    for(j = 0; j < bn; ++j)
+    {
+      c += ((dlimb_t)a[i] * b[j]) + r[i + j];
+      r[i + j] = (limb_t)c;
+      c >>= LIMB_BITS;
+    }
+
+    r[i + bn] = (limb_t)c;
+  }
+}
+
+/* r = a * b; r has an + bn limbs and must not overlap a or b.
+ */
+
+static void mul_raw(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                    size_t bn)
+{
+  if(an < bn)
+  {
+    const limb_t *t = a;
+    size_t tn = an;
+
+    a = b, an = bn;
+    b = t, bn = tn;
+  }
+
+  if(bn == 0)
+    memset(r, 0, an * sizeof(limb_t));
+  else if(bn < KARATSUBA_THRESHOLD)
+    mul_school(r, a, an, b, bn);
+  else if(an >= 2 * bn)
+  {
+    /* unbalanced: multiply b by successive bn-limb slices of a */
+
+    limb_t *t = C_malloc(2 * bn, limb_t);
+    size_t i;
+
+    memset(r, 0, (an + bn) * sizeof(limb_t));
+
+    for(i = 0; i < an; i += bn)
+    {
+      size_t len = ((an - i < bn) ? an - i : bn);
+
+      mul_raw(t, a + i, len, b, bn);
+      add_raw(r + i, r + i, an + bn - i, t, len + bn);
+    }
+
+    C_free(t);
+  }
+  else
+  {
+    /* Karatsuba: with a = a1.B^h + a0 and b = b1.B^h + b0,
+     * a.b = z2.B^2h + z1.B^h + z0, where z0 = a0.b0, z2 = a1.b1, and
+     * z1 = (a0 + a1)(b0 + b1) - z0 - z2
+     */
+
+    size_t h = an / 2, san, sbn, zn;
+    limb_t *sa, *sb, *z1;
+
+    sa = C_malloc(an - h + 1, limb_t);
+    san = an - h;
+    sa[san] = add_raw(sa, a + h, an - h, a, h);
+    ++san;
+
+    if(bn - h >= h)
+    {
+      sbn = bn - h;
+      sb = C_malloc(sbn + 1, limb_t);
+      sb[sbn] = add_raw(sb, b + h, bn - h, b, h);
+    }
+    else
+    {
+      sbn = h;
+      sb = C_malloc(sbn + 1, limb_t);
+      sb[sbn] = add_raw(sb, b, h, b + h, bn - h);
+    }
+    ++sbn;
+
+    zn = san + sbn;
+    z1 = C_malloc(zn, limb_t);
+    mul_raw(z1, sa, san, sb, sbn);
+
+    mul_raw(r, a, h, b, h);
+    mul_raw(r + (2 * h), a + h, an - h, b + h, bn - h);
+
+    sub_raw(z1, z1, zn, r, 2 * h);
+    sub_raw(z1, z1, zn, r + (2 * h), an + bn - (2 * h));
+    add_raw(r + h, r + h, an + bn - h, z1, normalize(z1, zn));
+
+    C_free(sa);
+    C_free(sb);
+    C_free(z1);
+  }
+}
+
+/* q = a / d, returning a % d; q has n limbs and may alias a.
+ */
+
+static limb_t divmod_1(limb_t *q, const limb_t *a, size_t n, limb_t d)
+{
+  dlimb_t rem = 0;
+
+  while(n-- > 0)
+  {
+    dlimb_t cur = (rem << LIMB_BITS) | a[n];
+
+    q[n] = (limb_t)(cur / d);
+    rem = cur % d;
+  }
+
+  return((limb_t)rem);
+}
+
+/* Knuth's algorithm D: q = u / v and r = u % v, where m >= n >= 2 and the
+ * top limb of v is nonzero. q has m - n + 1 limbs and r has n limbs; either
+ * may be NULL.
+ */
+
+static void divmod_knuth(limb_t *q, limb_t *r, const limb_t *u, size_t m,
+                         const limb_t *v, size_t n)
+{
+  limb_t *un = C_malloc(m + 1, limb_t), *vn = C_malloc(n, limb_t);
+  int s = 0;
+  size_t i, j;
+
+  /* normalize so that the top bit of the divisor is set */
+
+  while(!(v[n - 1] & (((limb_t)1) << (LIMB_BITS - 1 - s))))
+    ++s;
+
+  for(i = n - 1; i > 0; --i)
+    vn[i] = (limb_t)((((dlimb_t)v[i] << s) | ((dlimb_t)v[i - 1] >> (LIMB_BITS - s))));
+  vn[0] = v[0] << s;
+
+  un[m] = (limb_t)((dlimb_t)u[m - 1] >> (LIMB_BITS - s));
+  for(i = m - 1; i > 0; --i)
+    un[i] = (limb_t)((((dlimb_t)u[i] << s) | ((dlimb_t)u[i - 1] >> (LIMB_BITS - s))));
+  un[0] = u[0] << s;
+
+  for(j = m - n + 1; j-- > 0;)
+  {
+    dlimb_t num = ((dlimb_t)un[j + n] << LIMB_BITS) | un[j + n - 1];
+    dlimb_t qhat = num / vn[n - 1], rhat = num % vn[n - 1], p;
+    int64_t t, k = 0;
+
+    while((qhat >> LIMB_BITS)
+          || (qhat * vn[n - 2] > ((rhat << LIMB_BITS) | un[j + n - 2])))
+    {
+      --qhat;
+      rhat += vn[n - 1];
+      if(rhat >> LIMB_BITS)
+        break;
+    }
+
+    /* multiply and subtract */
+
+    for(i = 0; i < n; ++i)
+    {
+      p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xFFFFFFFFUL);
+      un[i + j] = (limb_t)t;
+      k = (int64_t)(p >> LIMB_BITS) - (t >> LIMB_BITS);
+    }
+    t = (int64_t)un[j + n] - k;
+    un[j + n] = (limb_t)t;
+
+    if(t < 0)
+    {
+      /* qhat was one too large; add back */
+
+      dlimb_t c = 0;
+
+      --qhat;
+      for(i = 0; i < n; ++i)
+      {
+        c += (dlimb_t)un[i + j] + vn[i];
+        un[i + j] = (limb_t)c;
+        c >>= LIMB_BITS;
+      }
+      un[j + n] += (limb_t)c;
+    }
+
+    if(q)
+      q[j] = (limb_t)qhat;
+  }
+
+  if(r)
+  {
+    for(i = 0; i < n; ++i)
+      r[i] = (limb_t)(((dlimb_t)un[i] >> s)
+                      | ((dlimb_t)un[i + 1] << (LIMB_BITS - s)));
+  }
+
+  C_free(un);
+  C_free(vn);
+}
+
+/* Magnitude operations on bignums. Signs are ignored. */
+
+/* r = a + b; r may alias a or b.
+ */
+
+static void mag_add(bignum_t *r, const bignum_t *a, const bignum_t *b)
+{
+  limb_t c;
+
+  if(a->n < b->n)
+  {
+    const bignum_t *t = a;
+
+    a = b, b = t;
+  }
+
+  reserve(r, a->n + 1);
+  c = add_raw(r->limbs, a->limbs, a->n, b->limbs, b->n);
+  r->limbs[a->n] = c;
+  r->n = a->n + (c != 0);
+}
+
+/* r = a - b, where a >= b; r may alias a or b.
+ */
+
+static void mag_sub(bignum_t *r, const bignum_t *a, const bignum_t *b)
+{
+  reserve(r, a->n);
+  sub_raw(r->limbs, a->limbs, a->n, b->limbs, b->n);
+  r->n = normalize(r->limbs, a->n);
+}
+
+/*
+ */
+
+static int mag_cmp(const bignum_t *a, const bignum_t *b)
+{
+  size_t i;
+
+  if(a->n != b->n)
+    return((a->n > b->n) ? 1 : -1);
+
+  for(i = a->n; i-- > 0;)
+  {
+    if(a->limbs[i] != b->limbs[i])
+      return((a->limbs[i] > b->limbs[i]) ? 1 : -1);
+  }
+
+  return(0);
+}
+
+/* r = a * b; r must not alias a or b.
+ */
+
+static void mag_mul(bignum_t *r, const bignum_t *a, const bignum_t *b)
+{
+  if(a->n == 0 || b->n == 0)
+  {
+    r->n = 0;
+    return;
+  }
+
+  reserve(r, a->n + b->n);
+  mul_raw(r->limbs, a->limbs, a->n, b->limbs, b->n);
+  r->n = normalize(r->limbs, a->n + b->n);
+}
+
+/* r = floor(a / B^k); r may alias a.
+ */
+
+static void mag_shr(bignum_t *r, const bignum_t *a, size_t k)
+{
+  if(a->n <= k)
+  {
+    r->n = 0;
+    return;
+  }
+
+  reserve(r, a->n - k);
+  memmove(r->limbs, a->limbs + k, (a->n - k) * sizeof(limb_t));
+  r->n = a->n - k;
+}
+
+/* r = B^k.
+ */
+
+static void mag_set_pow_b(bignum_t *r, size_t k)
+{
+  reserve(r, k + 1);
+  memset(r->limbs, 0, k * sizeof(limb_t));
+  r->limbs[k] = 1;
+  r->n = k + 1;
+}
+
+/* q = a / b and r = a % b; either may be NULL, neither may alias a or b.
+ */
+
+static void mag_divmod(bignum_t *q, bignum_t *r, const bignum_t *a,
+                       const bignum_t *b)
+{
+  if(a->n < b->n)
+  {
+    if(r)
+    {
+      reserve(r, a->n);
+      memcpy(r->limbs, a->limbs, a->n * sizeof(limb_t));
+      r->n = a->n;
+    }
+    if(q)
+      q->n = 0;
+  }
+  else if(b->n == 1)
+  {
+    limb_t *ql, rem;
+
+    if(q)
+      reserve(q, a->n);
+    ql = (q ? q->limbs : C_malloc(a->n, limb_t));
+    rem = divmod_1(ql, a->limbs, a->n, b->limbs[0]);
+
+    if(q)
+      q->n = normalize(q->limbs, a->n);
+    else
+      C_free(ql);
+
+    if(r)
+    {
+      reserve(r, 1);
+      r->limbs[0] = rem;
+      r->n = (rem != 0);
+    }
+  }
+  else
+  {
+    if(q)
+      reserve(q, a->n - b->n + 1);
+    if(r)
+      reserve(r, b->n);
+
+    divmod_knuth(q ? q->limbs : NULL, r ? r->limbs : NULL, a->limbs, a->n,
+                 b->limbs, b->n);
+
+    if(q)
+      q->n = normalize(q->limbs, a->n - b->n + 1);
+    if(r)
+      r->n = normalize(r->limbs, b->n);
+  }
+}
+
+/* mu = floor(B^2k / d), where d has k limbs. Above the threshold, the
+ * reciprocal of the top half of d is found recursively and refined by one
+ * Newton step, mu1 = mu0 + mu0 (B^2k - d mu0) / B^2k, which doubles its
+ * precision; the few units of error that remain are then removed exactly
+ * with a short division.
+ */
+
+static void reciprocal(bignum_t *mu, const limb_t *d, size_t k)
+{
+  bignum_t dd, bk, p, e, t;
+  c_bool_t over;
+
+  dd.limbs = (limb_t *)d;
+  dd.n = dd.cap = k;
+
+  bn_init(&bk);
+  mag_set_pow_b(&bk, 2 * k);
+
+  if(k <= RECIP_THRESHOLD)
+  {
+    mag_divmod(mu, NULL, &bk, &dd);
+    bn_free(&bk);
+    return;
+  }
+
+  bn_init(&p);
+  bn_init(&e);
+  bn_init(&t);
+
+  {
+    size_t h = (k / 2) + 1, l = k - h;
+
+    /* mu0 = floor(B^2h / dh) * B^l, where dh is the top h limbs of d */
+
+    reciprocal(&t, d + l, h);
+    reserve(mu, t.n + l);
+    memset(mu->limbs, 0, l * sizeof(limb_t));
+    memcpy(mu->limbs + l, t.limbs, t.n * sizeof(limb_t));
+    mu->n = t.n + l;
+  }
+
+  /* Newton step */
+
+  mag_mul(&p, &dd, mu);
+  over = (mag_cmp(&p, &bk) > 0);
+  if(over)
+    mag_sub(&e, &p, &bk);
+  else
+    mag_sub(&e, &bk, &p);
+
+  mag_mul(&t, mu, &e);
+  mag_shr(&t, &t, 2 * k);
+  if(over)
+    mag_sub(mu, mu, &t);
+  else
+    mag_add(mu, mu, &t);
+
+  /* exact correction */
+
+  mag_mul(&p, &dd, mu);
+  if(mag_cmp(&p, &bk) > 0)
+  {
+    /* mu is too large by ceil((d mu - B^2k) / d) */
+
+    mag_sub(&e, &p, &bk);
+    mag_add(&e, &e, &dd);
+    mag_sub(&e, &e, &one);
+    mag_divmod(&t, NULL, &e, &dd);
+    mag_sub(mu, mu, &t);
+  }
+  else
+  {
+    mag_sub(&e, &bk, &p);
+    mag_divmod(&t, NULL, &e, &dd);
+    mag_add(mu, mu, &t);
+  }
+
+  bn_free(&bk);
+  bn_free(&p);
+  bn_free(&e);
+  bn_free(&t);
+}
+
+/* Barrett division: q = x / d and r = x % d, where x < B^2k, d has k limbs,
+ * and mu = floor(B^2k / d).
+ */
+
+static void barrett_divmod(bignum_t *q, bignum_t *r, const bignum_t *x,
+                           const bignum_t *d, const bignum_t *mu)
+{
+  bignum_t t;
+  size_t k = d->n;
+
+  bn_init(&t);
+  mag_shr(&t, x, k - 1);
+  mag_mul(q, &t, mu);
+  mag_shr(q, q, k + 1);
+
+  mag_mul(&t, q, d);
+  mag_sub(r, x, &t);
+
+  while(mag_cmp(r, d) >= 0)
+  {
+    mag_sub(r, r, d);
+    mag_add(q, q, &one);
+  }
+
+  bn_free(&t);
+}
+
+/*
+ */
+
+static radix_t *get_radix(int base)
+{
+  radix_t *rx = radixes[base];
+
+  if(!rx)
+  {
+    dlimb_t big = base;
+
+    rx = C_new(radix_t);
+    rx->base = base;
+    rx->chunk = 1;
+
+    while(big * base <= 0xFFFFFFFFUL)
+      big *= base, rx->chunk++;
+
+    rx->big = (limb_t)big;
+    bn_init(&(rx->pow[0]));
+    reserve(&(rx->pow[0]), 1);
+    rx->pow[0].limbs[0] = rx->big;
+    rx->pow[0].n = 1;
+    rx->digits[0] = rx->chunk;
+    bn_init(&(rx->recip[0]));
+    rx->nlevels = 1;
+
+    radixes[base] = rx;
+  }
+
+  return(rx);
+}
+
+/* Make sure that P[0] through P[j] are available.
+ */
+
+static void extend_powers(radix_t *rx, int j)
+{
+  while(rx->nlevels <= j)
+  {
+    int i = rx->nlevels++;
+
+    bn_init(&(rx->pow[i]));
+    bn_init(&(rx->recip[i]));
+    mag_mul(&(rx->pow[i]), &(rx->pow[i - 1]), &(rx->pow[i - 1]));
+    rx->digits[i] = rx->digits[i - 1] * 2;
+  }
+}
+
+/*
+ */
+
+static int digit_value(char c)
+{
+  if(isdigit((unsigned char)c))
+    return(c - '0');
+  else if(c >= 'a' && c <= 'z')
+    return(c - 'a' + 10);
+  else if(c >= 'A' && c <= 'Z')
+    return(c - 'A' + 10);
+  else
+    return(99);
+}
+
+/* x = x * m + a.
+ */
+
+static void muladd_1(bignum_t *x, limb_t m, limb_t a)
+{
+  dlimb_t c = a;
+  size_t i;
+
+  for(i = 0; i < x->n; ++i)
+  {
+    c += (dlimb_t)x->limbs[i] * m;
+    x->limbs[i] = (limb_t)c;
+    c >>= LIMB_BITS;
+  }
+
+  if(c)
+  {
+    reserve(x, x->n + 1);
+    x->limbs[x->n++] = (limb_t)c;
+  }
+}
+
+/* Parse len valid digits.
+ */
+
+static void parse_rec(radix_t *rx, bignum_t *x, const char *s, size_t len)
+{
+  if(len <= (size_t)(PARSE_THRESHOLD * rx->chunk))
+  {
+    /* short multiplication, a limb's worth of digits at a time */
+
+    size_t first = len % rx->chunk;
+    limb_t v = 0, m = 1;
+    int i;
+
+    x->n = 0;
+
+    for(i = 0; i < (int)first; ++i)
+      v = (v * rx->base) + digit_value(*s++), m *= rx->base;
+    if(first)
+      muladd_1(x, m, v);
+
+    for(len -= first; len > 0; len -= rx->chunk)
+    {
+      for(v = 0, i = 0; i < rx->chunk; ++i)
+        v = (v * rx->base) + digit_value(*s++);
+      muladd_1(x, rx->big, v);
+    }
+  }
+  else
+  {
+    bignum_t hi, lo;
+    int j = 0;
+
+    /* find the largest P[j] with fewer digits than the string */
+
+    for(;;)
+    {
+      extend_powers(rx, j + 1);
+      if(rx->digits[j + 1] >= len)
+        break;
+      ++j;
+    }
+
+    bn_init(&hi);
+    bn_init(&lo);
+    parse_rec(rx, &hi, s, len - rx->digits[j]);
+    parse_rec(rx, &lo, s + len - rx->digits[j], rx->digits[j]);
+
+    mag_mul(x, &hi, &(rx->pow[j]));
+    mag_add(x, x, &lo);
+
+    bn_free(&hi);
+    bn_free(&lo);
+  }
+}
+
+/* Replace x by its value modulo 2^bits, which for a negative x is its
+ * two's-complement bit pattern in that width.
+ */
+
+void bn_twos(bignum_t *x, unsigned int bits)
+{
+  size_t n = (bits + LIMB_BITS - 1) / LIMB_BITS, i;
+
+  reserve(x, n);
+  for(i = x->n; i < n; ++i)
+    x->limbs[i] = 0;
+
+  if(x->neg)
+  {
+    /* -x = ~x + 1 */
+
+    dlimb_t c = 1;
+
+    for(i = 0; i < n; ++i)
+    {
+      c += (limb_t)~x->limbs[i];
+      x->limbs[i] = (limb_t)c;
+      c >>= LIMB_BITS;
+    }
+  }
+
+  if(bits % LIMB_BITS)
+    x->limbs[n - 1] &= (((limb_t)1) << (bits % LIMB_BITS)) - 1;
+
+  x->n = normalize(x->limbs, n);
+  x->neg = FALSE;
+}
+
+/*
+ */
+
+c_bool_t bn_testbit(const bignum_t *x, unsigned int bit)
+{
+  size_t i = bit / LIMB_BITS;
+
+  return((i < x->n) && ((x->limbs[i] >> (bit % LIMB_BITS)) & 1));
+}
+
+/* r = floor(x / 2^pos) mod 2^len, for a non-negative x; r must not alias x.
+ */
+
+void bn_bits(bignum_t *r, const bignum_t *x, unsigned int pos,
+             unsigned int len)
+{
+  size_t li = pos / LIMB_BITS, i;
+  int off = pos % LIMB_BITS;
+
+  r->n = 0;
+  r->neg = FALSE;
+
+  if(li >= x->n)
+    return;
+
+  r->n = x->n - li;
+  reserve(r, r->n);
+
+  for(i = 0; i < r->n; ++i)
+  {
+    dlimb_t v = x->limbs[li + i];
+
+    if(li + i + 1 < x->n)
+      v |= (dlimb_t)x->limbs[li + i + 1] << LIMB_BITS;
+
+    r->limbs[i] = (limb_t)(v >> off);
+  }
+
+  bn_twos(r, len);
+}
+
+/* Returns log2(base) if base is a power of two, or 0 otherwise.
+ */
+
+int bn_pow2_bits(int base)
+{
+  int bits = 0;
+
+  if(base & (base - 1))
+    return(0);
+
+  while(base > 1)
+    base >>= 1, ++bits;
+
+  return(bits);
+}
+
+/* Parse len valid digits in a power-of-two base, by packing their bits
+ * directly into limbs.
+ */
+
+static void parse_pow2(bignum_t *x, const char *s, size_t len, int bits)
+{
+  dlimb_t acc = 0;
+  int accbits = 0;
+
+  reserve(x, ((len * bits) / LIMB_BITS) + 1);
+  x->n = 0;
+
+  while(len-- > 0)
+  {
+    acc |= (dlimb_t)digit_value(s[len]) << accbits;
+    accbits += bits;
+
+    if(accbits >= LIMB_BITS)
+    {
+      x->limbs[x->n++] = (limb_t)acc;
+      acc >>= LIMB_BITS;
+      accbits -= LIMB_BITS;
+    }
+  }
+
+  if(accbits > 0)
+    x->limbs[x->n++] = (limb_t)acc;
+
+  x->n = normalize(x->limbs, x->n);
+}
+
+/* Set x to the value of exactly len valid digits in the given base, negated
+ * if neg is TRUE.
+ */
+
+void bn_set_digits(bignum_t *x, const char *s, size_t len, int base,
+                   c_bool_t neg)
+{
+  int bits = bn_pow2_bits(base);
+
+  if(bits)
+    parse_pow2(x, s, len, bits);
+  else
+    parse_rec(get_radix(base), x, s, len);
+
+  x->neg = (neg && (x->n > 0));
+}
+
+/* Write x, which must have at most FORMAT_THRESHOLD limbs, as exactly ndig
+ * digits.
+ */
+
+static void format_small(radix_t *rx, const bignum_t *x, char *out,
+                         size_t ndig)
+{
+  limb_t t[FORMAT_THRESHOLD];
+  size_t n = x->n;
+
+  memcpy(t, x->limbs, n * sizeof(limb_t));
+
+  while(n > 0)
+  {
+    limb_t rem = divmod_1(t, t, n, rx->big);
+    int i;
+
+    n = normalize(t, n);
+
+    for(i = 0; (i < rx->chunk) && (ndig > 0); ++i)
+    {
+      out[--ndig] = digit_chars[rem % rx->base];
+      rem /= rx->base;
+    }
+  }
+
+  memset(out, '0', ndig);
+}
+
+/* Write x < P[j+1] as exactly ndig digits.
+ */
+
+static void format_rec(radix_t *rx, const bignum_t *x, int j, char *out,
+                       size_t ndig)
+{
+  bignum_t q, r;
+
+  if((x->n <= FORMAT_THRESHOLD) || (j < 0))
+  {
+    format_small(rx, x, out, ndig);
+    return;
+  }
+
+  if(rx->recip[j].n == 0)
+    reciprocal(&(rx->recip[j]), rx->pow[j].limbs, rx->pow[j].n);
+
+  bn_init(&q);
+  bn_init(&r);
+  barrett_divmod(&q, &r, x, &(rx->pow[j]), &(rx->recip[j]));
+
+  format_rec(rx, &q, j - 1, out, ndig - rx->digits[j]);
+  format_rec(rx, &r, j - 1, out + ndig - rx->digits[j], rx->digits[j]);
+
+  bn_free(&q);
+  bn_free(&r);
+}
+
+/* Write x as exactly ndig digits in a power-of-two base, by extracting
+ * each digit's bits directly from the limbs.
+ */
+
+static void format_pow2(const bignum_t *x, int bits, char *out, size_t ndig)
+{
+  limb_t mask = (1U << bits) - 1;
+  size_t k;
+
+  for(k = 0; k < ndig; ++k)
+  {
+    size_t pos = k * bits, li = pos / LIMB_BITS;
+    int off = pos % LIMB_BITS;
+    dlimb_t v = x->limbs[li];
+
+    if((li + 1) < x->n)
+      v |= (dlimb_t)x->limbs[li + 1] << LIMB_BITS;
+
+    out[ndig - 1 - k] = digit_chars[(v >> off) & mask];
+  }
+}
+
+/* Format x in the given base into *buf, which is grown as needed. Returns
+ * the length of the resulting (NUL-terminated) string.
+ */
+
+size_t bn_format(const bignum_t *x, int base, char **buf, size_t *bufsz)
+{
+  radix_t *rx = NULL;
+  size_t ndig, skip, len;
+  char *p;
+  int j = -1, bits = bn_pow2_bits(base);
+
+  if(x->n == 0)
+    ndig = 1;
+  else if(bits)
+  {
+    limb_t top = x->limbs[x->n - 1];
+    size_t nbits = (x->n - 1) * LIMB_BITS;
+
+    while(top)
+      top >>= 1, ++nbits;
+
+    ndig = (nbits + bits - 1) / bits;
+  }
+  else if(x->n <= FORMAT_THRESHOLD)
+    ndig = (x->n * LIMB_BITS) + 1;
+  else
+  {
+    /* find the smallest P[j+1] that exceeds x */
+
+    rx = get_radix(base);
+
+    for(j = 0; ; ++j)
+    {
+      extend_powers(rx, j + 1);
+      if(mag_cmp(&(rx->pow[j + 1]), x) > 0)
+        break;
+    }
+
+    ndig = rx->digits[j + 1];
+  }
+
+  if(*bufsz < ndig + 2)
+  {
+    *bufsz = ndig + 2;
+    *buf = C_realloc(*buf, *bufsz, char);
+  }
+
+  p = *buf + 1;
+  if(x->n == 0)
+    *p = '0';
+  else if(bits)
+    format_pow2(x, bits, p, ndig);
+  else
+    format_rec((rx ? rx : get_radix(base)), x, j, p, ndig);
+
+  for(skip = 0; (skip < ndig - 1) && (p[skip] == '0'); ++skip);
+
+  p += skip;
+  len = ndig - skip;
+
+  if(x->neg)
+    *--p = '-', ++len;
+
+  memmove(*buf, p, len);
+  (*buf)[len] = '\0';
+
+  return(len);
+}
+
+/* end of source file */
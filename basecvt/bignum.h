@@ -0,0 +1,59 @@
+/* ----------------------------------------------------------------------------
+   basecvt - interactive base converter
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __BASECVT_BIGNUM_H
+#define __BASECVT_BIGNUM_H
+
+#include <stdint.h>
+
+typedef uint32_t bn_limb_t;
+
+/* An arbitrary-precision signed integer, as a magnitude in base 2^32 (least
+ * significant limb first) and a sign. Zero has no limbs.
+ */
+
+typedef struct
+{
+  bn_limb_t *limbs;
+  size_t n;
+  size_t cap;
+  c_bool_t neg;
+} bignum_t;
+
+extern void bn_init(bignum_t *x);
+extern void bn_free(bignum_t *x);
+
+extern void bn_set_digits(bignum_t *x, const char *s, size_t len, int base,
+                          c_bool_t neg);
+extern size_t bn_format(const bignum_t *x, int base, char **buf,
+                        size_t *bufsz);
+
+extern void bn_twos(bignum_t *x, unsigned int bits);
+extern c_bool_t bn_testbit(const bignum_t *x, unsigned int bit);
+extern void bn_bits(bignum_t *r, const bignum_t *x, unsigned int pos,
+                    unsigned int len);
+
+extern int bn_pow2_bits(int base);
+
+#endif /* __BASECVT_BIGNUM_H */
+
+/* end of header file */
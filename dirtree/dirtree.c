@@ -27,33 +27,691 @@
 /* --- System Headers --- */
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <cbase/cbase.h>
 
 /* --- Local Headers --- */
 
+#include "walk.h"
+#include "dupes.h"
+
 /* --- Macros --- */
 
 #define DFL_TABWIDTH 2
+#define MAX_JOBS 256
+
+#define OUTBUFSZ (256 * 1024) /* output is written once this much is queued */
+#define USAGE_COLS 22         /* width of the disk usage columns */
+#define INITIAL_INODES 1024
+#define MAX_TABWIDTH 8
+
+/* box-drawing characters, in UTF-8 */
+
+#define BOX_VERT "\xe2\x94\x82"    /* U+2502 */
+#define BOX_HORIZ "\xe2\x94\x80"   /* U+2500 */
+#define BOX_TEE "\xe2\x94\x9c"     /* U+251C */
+#define BOX_ELBOW "\xe2\x94\x94"   /* U+2514 */
 
 #define HEADER "dirtree v" VERSION " - Mark Lindner"
-#define USAGE "[ -t <tabwidth> ] [ -h ] [ directory ]"
+#define USAGE "[ -t <tabwidth> ] [ -j <jobs> ] [ -s ] [ -d <depth> ] " \
+  "[ -L <depth> ] [ -x ] [ -e <pattern> ] [ -i <pattern> ] [ -g ] [ -U ] " \
+  "[ -c <snapshot> ] [ -u ] [ -J | -0 | -D ] [ -h ] " \
+  "[ directory ]"
+
+/* --- Types --- */
+
+/* Disk usage totals. */
+
+typedef struct
+{
+  uint64_t size;    /* apparent size in bytes */
+  uint64_t blocks;  /* 512-byte blocks allocated */
+  uint64_t files;   /* non-directories */
+} usage_t;
+
+/* A set of (device, inode) pairs, for counting hard-linked files once. */
+
+typedef struct
+{
+  uint64_t *slots;  /* pairs of dev + 1 and ino; a zero dev marks a free
+                       slot */
+  size_t size;      /* in pairs; a power of two */
+  size_t count;
+} inodes_t;
+
+/* The text that goes before an entry's name: a connector, and the
+ * continuation that its subdirectory's entries inherit, for entries that are
+ * or are not the last in their directory.
+ */
+
+typedef struct
+{
+  char text[(MAX_TABWIDTH + 2) * 3];
+  size_t len;
+} glyphs_t;
+
+typedef enum { FMT_TEXT, FMT_JSON, FMT_NUL, FMT_DUPES } format_t;
+
+/* --- File Scope Variables --- */
 
 static int tab_width = DFL_TABWIDTH;
+static uint_t max_display = UINT_MAX;
+static c_bool_t show_usage = FALSE;
+static format_t format = FMT_TEXT;
+
+static char *obuf = NULL;
+static size_t olen = 0, ocap = 0;
+static uint_t deferred = 0;  /* directory lines awaiting their totals */
+
+static inodes_t inodes;
+
+static snapwriter_t *snapw = NULL;
+
+static glyphs_t connector[2], continuation[2];  /* indexed by `last' */
+static char *prefix = NULL;  /* the indentation of the current directory */
+static size_t plen = 0, pcap = 0;
 
 /* --- Functions --- */
 
-static c_bool_t examine(const char *file, const struct stat *fst, uint_t depth,
-                        void *hook)
+static c_bool_t out_flush(void)
+{
+  c_bool_t ok = (fwrite(obuf, 1, olen, stdout) == olen);
+
+  olen = 0;
+  return(ok);
+}
+
+/* Make room for n more bytes of output, writing out what has been queued
+ * if possible; while directory lines await their totals, it must all be
+ * held.
+ */
+
+static c_bool_t out_reserve(size_t n)
+{
+  if((olen + n > OUTBUFSZ) && (deferred == 0) && !out_flush())
+    return(FALSE);
+
+  if(olen + n > ocap)
+  {
+    do
+      ocap = (ocap ? ocap * 2 : OUTBUFSZ);
+    while(olen + n > ocap);
+
+    obuf = C_realloc(obuf, ocap, char);
+  }
+
+  return(TRUE);
+}
+
+/* Format a size, or a count if unit is 1000, in 6 columns, in the style of
+ * du -h.
+ */
+
+static void human(char *buf, uint64_t v, uint_t unit)
+{
+  static const char *units = "KMGTPE";
+  double d = v;
+  int u = -1;
+
+  if(v < unit)
+  {
+    snprintf(buf, 7, "%6u", (uint_t)v);
+    return;
+  }
+
+  while((d >= unit) && (u < 5))
+    d /= unit, ++u;
+
+  if(d < 9.95)
+    snprintf(buf, 7, "%5.1f%c", d, units[u]);
+  else
+    snprintf(buf, 7, "%5.0f%c", d, units[u]);
+}
+
+/* Fill in the usage columns reserved at the given offset.
+ */
+
+static void put_usage(size_t off, const usage_t *u, c_bool_t dir)
 {
-  int i;
+  char buf[USAGE_COLS + 1];
+
+  human(buf, u->size, 1024);
+  buf[6] = ' ';
+  human(buf + 7, u->blocks * 512, 1024);
+  buf[13] = ' ';
+
+  if(dir)
+    human(buf + 14, u->files, 1000);
+  else
+    memset(buf + 14, ' ', 6);
+
+  buf[20] = buf[21] = ' ';
+  memcpy(obuf + off, buf, USAGE_COLS);
+}
+
+/* Add a file to the set of inodes; returns FALSE if it was already there.
+ */
+
+static c_bool_t inodes_add(inodes_t *set, uint64_t dev, uint64_t ino)
+{
+  size_t i;
+
+  if(set->count * 2 >= set->size)
+  {
+    uint64_t *old = set->slots;
+    size_t oldsize = set->size;
+
+    set->size = (set->size ? set->size * 2 : INITIAL_INODES);
+    set->slots = C_newa(set->size * 2, uint64_t);
+    set->count = 0;
+
+    for(i = 0; i < oldsize; ++i)
+    {
+      if(old[2 * i])
+        inodes_add(set, old[2 * i] - 1, old[(2 * i) + 1]);
+    }
+
+    C_free(old);
+  }
+
+  for(i = ((ino * 0x9E3779B97F4A7C15ULL) ^ dev) & (set->size - 1);
+      set->slots[2 * i];
+      i = (i + 1) & (set->size - 1))
+  {
+    if((set->slots[2 * i] == dev + 1) && (set->slots[(2 * i) + 1] == ino))
+      return(FALSE);
+  }
+
+  set->slots[2 * i] = dev + 1;
+  set->slots[(2 * i) + 1] = ino;
+  ++set->count;
+
+  return(TRUE);
+}
+
+/* Set up the connectors and continuations: with graphics, box-drawing lines
+ * whose horizontal part is tab_width wide, and otherwise just tab_width
+ * spaces of indentation per level.
+ */
+
+static void init_glyphs(c_bool_t graphics)
+{
+  int i, last;
+
+  pcap = 16 * (MAX_TABWIDTH + 2) * 3;
+  prefix = C_malloc(pcap, char);
+
+  for(last = 0; last < 2; ++last)
+  {
+    glyphs_t *c = &(connector[last]), *k = &(continuation[last]);
+
+    c->len = k->len = 0;
+
+    if(!graphics)
+    {
+      memset(k->text, ' ', tab_width);
+      k->len = tab_width;
+      continue;
+    }
+
+    memcpy(c->text, (last ? BOX_ELBOW : BOX_TEE), 3);
+    c->len = 3;
+    for(i = 0; i < tab_width; ++i, c->len += 3)
+      memcpy(c->text + c->len, BOX_HORIZ, 3);
+    c->text[c->len++] = ' ';
+
+    if(last)
+      k->text[k->len++] = ' ';
+    else
+    {
+      memcpy(k->text, BOX_VERT, 3);
+      k->len = 3;
+    }
+    memset(k->text + k->len, ' ', tab_width + 1);
+    k->len += tab_width + 1;
+  }
+}
+
+/* Extend or shorten the current prefix: the indentation, or with -0, the
+ * path of the current directory.
+ */
+
+static void push_prefix(const char *s, size_t len)
+{
+  if(plen + len > pcap)
+  {
+    pcap = (plen + len) * 2;
+    prefix = C_realloc(prefix, pcap, char);
+  }
+
+  memcpy(prefix + plen, s, len);
+  plen += len;
+}
+
+/*
+ */
+
+static void pop_prefix(size_t len)
+{
+  plen -= len;
+}
+
+/* Queue the line for one entry, leaving room for the usage columns if they
+ * are shown. Returns the offset of those columns.
+ */
+
+static c_bool_t examine(const char *file, const entry_t *e, c_bool_t last,
+                        size_t *cols)
+{
+  size_t len = strlen(file);
+  const glyphs_t *c = &(connector[last]);
+
+  if(!out_reserve(USAGE_COLS + plen + c->len + len + 2))
+    return(FALSE);
+
+  *cols = olen;
+  if(show_usage)
+    olen += USAGE_COLS;
+
+  memcpy(obuf + olen, prefix, plen);
+  olen += plen;
+  memcpy(obuf + olen, c->text, c->len);
+  olen += c->len;
+  memcpy(obuf + olen, file, len);
+  olen += len;
+  if(S_ISDIR(e->mode))
+    obuf[olen++] = '/';
+  obuf[olen++] = '\n';
+
+  return(TRUE);
+}
+
+/* Queue an entry for -0 output: its depth, a tab, and its full path, with a
+ * slash after directories, terminated by a NUL.
+ */
+
+static c_bool_t examine_nul(const char *file, const entry_t *e, uint_t depth)
+{
+  size_t len = strlen(file);
+
+  if(!out_reserve(plen + len + 16))
+    return(FALSE);
+
+  olen += sprintf(obuf + olen, "%u\t", depth);
+  memcpy(obuf + olen, prefix, plen);
+  olen += plen;
+  memcpy(obuf + olen, file, len);
+  olen += len;
+  if(S_ISDIR(e->mode))
+    obuf[olen++] = '/';
+  obuf[olen++] = '\0';
+
+  return(TRUE);
+}
+
+/* Return the length of the valid UTF-8 sequence at s, or 0 if there is
+ * none.
+ */
+
+static size_t utf8_len(const unsigned char *s)
+{
+  uint_t lo = 0x80, hi = 0xBF;
+  size_t i, n;
+
+  if(*s < 0x80)
+    return(1);
+  else if((*s >= 0xC2) && (*s <= 0xDF))
+    n = 2;
+  else if((*s >= 0xE0) && (*s <= 0xEF))
+  {
+    n = 3;
+    if(*s == 0xE0)
+      lo = 0xA0;
+    else if(*s == 0xED)
+      hi = 0x9F;   /* no surrogates */
+  }
+  else if((*s >= 0xF0) && (*s <= 0xF4))
+  {
+    n = 4;
+    if(*s == 0xF0)
+      lo = 0x90;
+    else if(*s == 0xF4)
+      hi = 0x8F;
+  }
+  else
+    return(0);
+
+  if((s[1] < lo) || (s[1] > hi))
+    return(0);
+
+  for(i = 2; i < n; ++i)
+  {
+    if((s[i] < 0x80) || (s[i] > 0xBF))
+      return(0);
+  }
+
+  return(n);
+}
+
+/* Append a name as a JSON string. Bytes that are not valid UTF-8 are
+ * written as the lone surrogates U+DC80 to U+DCFF, as Python's
+ * surrogateescape does, so that the original name can be recovered. The
+ * caller must have reserved 6 bytes per byte of the name, plus 2.
+ */
+
+static void put_json_string(const char *str)
+{
+  static const char *hex = "0123456789abcdef";
+  const unsigned char *s = (const unsigned char *)str;
+  char *o = obuf + olen;
+  size_t n;
+
+  *o++ = '"';
+
+  while(*s)
+  {
+    if((*s >= 0x20) && (*s < 0x80))
+    {
+      if((*s == '"') || (*s == '\\'))
+        *o++ = '\\';
+      *o++ = *s++;
+    }
+    else if(*s < 0x20)
+    {
+      *o++ = '\\';
+      switch(*s)
+      {
+        case '\b': *o++ = 'b'; break;
+        case '\f': *o++ = 'f'; break;
+        case '\n': *o++ = 'n'; break;
+        case '\r': *o++ = 'r'; break;
+        case '\t': *o++ = 't'; break;
+        default:
+          memcpy(o, "u00", 3);
+          o += 3;
+          *o++ = hex[*s >> 4];
+          *o++ = hex[*s & 0xF];
+          break;
+      }
+      ++s;
+    }
+    else if((n = utf8_len(s)) > 0)
+    {
+      memcpy(o, s, n);
+      o += n;
+      s += n;
+    }
+    else
+    {
+      memcpy(o, "\\udc", 4);
+      o += 4;
+      *o++ = hex[*s >> 4];
+      *o++ = hex[*s & 0xF];
+      ++s;
+    }
+  }
+
+  *o++ = '"';
+  olen = o - obuf;
+}
+
+/*
+ */
+
+static const char *json_type(mode_t mode)
+{
+  switch(mode & S_IFMT)
+  {
+    case S_IFDIR:
+      return("directory");
+    case S_IFLNK:
+      return("link");
+    case S_IFIFO:
+      return("fifo");
+    case S_IFSOCK:
+      return("socket");
+    case S_IFCHR:
+      return("char");
+    case S_IFBLK:
+      return("block");
+    default:
+      return("file");
+  }
+}
+
+/* Queue the start of the JSON object for an entry, after the separator
+ * from the previous one: everything but its sizes and closing brace, which
+ * json_close() adds. If the directory's contents will follow, the array for
+ * them is opened.
+ */
+
+static c_bool_t json_open(const char *file, const entry_t *e,
+                          const char *sep, c_bool_t contents)
+{
+  size_t len = strlen(file);
+
+  if(!out_reserve((len * 6) + 64))
+    return(FALSE);
+
+  olen += sprintf(obuf + olen, "%s{\"type\":\"%s\",\"name\":", sep,
+                  json_type(e->mode));
+  put_json_string(file);
+
+  if(contents)
+  {
+    memcpy(obuf + olen, ",\"contents\":[", 13);
+    olen += 13;
+  }
+
+  return(TRUE);
+}
+
+/*
+ */
+
+static c_bool_t json_close(const entry_t *e, const usage_t *u,
+                           c_bool_t contents)
+{
+  if(!out_reserve(96))
+    return(FALSE);
+
+  if(contents)
+  {
+    memcpy(obuf + olen, "\n]", 2);
+    olen += 2;
+  }
+
+  if(show_usage)
+  {
+    olen += sprintf(obuf + olen, ",\"size\":%llu,\"blocks\":%llu",
+                    (unsigned long long)u->size,
+                    (unsigned long long)u->blocks);
+    if(S_ISDIR(e->mode))
+      olen += sprintf(obuf + olen, ",\"files\":%llu",
+                      (unsigned long long)u->files);
+  }
+
+  obuf[olen++] = '}';
+
+  return(TRUE);
+}
+
+/* Account for one entry in a usage total. Hard-linked files count only
+ * the first time they are seen.
+ */
+
+static void account(const entry_t *e, usage_t *u)
+{
+  if(!S_ISDIR(e->mode) && (e->nlink > 1) && !inodes_add(&inodes, e->dev,
+                                                         e->ino))
+    return;
+
+  u->size += e->size;
+  u->blocks += e->blocks;
+  if(!S_ISDIR(e->mode))
+    ++u->files;
+}
+
+/* Print the entries of a directory, and recursively those of each of its
+ * subdirectories, in depth-first order, adding up their usage in total;
+ * each node is freed once it has been printed. Below the display depth,
+ * subdirectories are still walked if usage is being shown; otherwise the
+ * walker doesn't read them at all. If a snapshot is being written, each directory is recorded in
+ * it under its parent's index.
+ */
+
+static c_bool_t print_tree(walker_t *w, node_t *node, usage_t *total,
+                           uint32_t parent)
+{
+  size_t i, cols = 0;
+  c_bool_t ok = TRUE, shown = (node->depth < max_display);
+  uint32_t self = SNAP_NONE;
+
+  walk_wait(w, node);
+
+  if(snapw)
+  {
+    self = snapw_dir(snapw, parent, (node->parent ? node->name : ""),
+                     node->mtime, node->mtime_ns);
+
+    for(i = 0; i < node->nentries; ++i)
+      snapw_entry(snapw, NODE_NAME(node, &(node->entries[i])),
+                  node->entries[i].mode);
+  }
+
+  for(i = 0; ok && (i < node->nentries); ++i)
+  {
+    const entry_t *e = &(node->entries[i]);
+    const char *name = NODE_NAME(node, e);
+    c_bool_t last = (i == node->nentries - 1);
+    c_bool_t descend = (e->dir && (shown || show_usage));
+    c_bool_t contents = (e->dir && (node->depth + 1 < max_display));
+    usage_t u = { 0, 0, 0 };
+    const char *pfx = NULL;
+    size_t pfxlen = 0;
+
+    if(shown)
+    {
+      switch(format)
+      {
+        case FMT_JSON:
+          ok = json_open(name, e, (i ? ",\n" : "\n"), contents);
+          break;
+
+        case FMT_NUL:
+          ok = examine_nul(name, e, node->depth);
+          break;
+
+        default:
+          ok = examine(name, e, last, &cols);
+          break;
+      }
+    }
+
+    if(show_usage)
+      account(e, &u);
+
+    if(ok && descend)
+    {
+      /* in text mode, the usage columns can't be filled in until the
+       * whole subdirectory has been walked
+       */
+
+      if(show_usage && (format == FMT_TEXT))
+        ++deferred;
+
+      if(format == FMT_TEXT)
+        pfx = continuation[last].text, pfxlen = continuation[last].len;
+      else if(format == FMT_NUL)
+        pfx = name, pfxlen = strlen(name);
+
+      push_prefix(pfx, pfxlen);
+      if(format == FMT_NUL)
+        push_prefix("/", 1), ++pfxlen;
+
+      ok = print_tree(w, e->dir, &u, self);
+      pop_prefix(pfxlen);
+
+      if(show_usage && (format == FMT_TEXT))
+        --deferred;
+    }
+
+    if(ok && shown)
+    {
+      if(format == FMT_JSON)
+        ok = json_close(e, &u, contents);
+      else if(show_usage && (format == FMT_TEXT))
+        put_usage(cols, &u, S_ISDIR(e->mode));
+    }
+
+    total->size += u.size;
+    total->blocks += u.blocks;
+    total->files += u.files;
+  }
+
+  if(ok)
+    walk_release(w, node);
+
+  return(ok);
+}
+
+/* Gather the regular files beneath a directory for the duplicate finder,
+ * with their full paths.
+ */
+
+static void collect(walker_t *w, node_t *node, dupes_t *d)
+{
+  size_t i, len;
+
+  walk_wait(w, node);
+
+  for(i = 0; i < node->nentries; ++i)
+  {
+    const entry_t *e = &(node->entries[i]);
+    const char *name = NODE_NAME(node, e);
+
+    len = strlen(name);
+    push_prefix(name, len);
+
+    if(S_ISREG(e->mode))
+      dupes_add(d, prefix, plen, e->size, e->dev, e->ino);
+    else if(e->dir)
+    {
+      push_prefix("/", 1);
+      collect(w, e->dir, d);
+      pop_prefix(1);
+    }
+
+    pop_prefix(len);
+  }
+
+  walk_release(w, node);
+}
+
+/* Queue one line of the duplicates report; groups are separated by blank
+ * lines.
+ */
+
+static c_bool_t emit_dupe(const char *path, c_bool_t first, void *arg)
+{
+  size_t len = strlen(path);
+  c_bool_t *started = (c_bool_t *)arg;
+
+  if(!out_reserve(len + 2))
+    return(FALSE);
+
+  if(first && *started)
+    obuf[olen++] = '\n';
+  *started = TRUE;
+
+  memcpy(obuf + olen, path, len);
+  olen += len;
+  obuf[olen++] = '\n';
 
-  for(i = depth * tab_width; i--; putchar(' '));
-  fputs(file, stdout);
-  if(S_ISDIR(fst->st_mode))
-    putchar('/');
-  putchar('\n');
   return(TRUE);
 }
 
@@ -63,14 +721,23 @@ static c_bool_t examine(const char *file, const struct stat *fst, uint_t depth,
 int main(int argc, char **argv)
 {
   int c, tab;
-  c_bool_t errflag = FALSE;
-  char *dir = ".";
+  c_bool_t errflag = FALSE, graphics = FALSE, ok;
+  walkopts_t opts = { 1, WALK_SORT, 0, NULL, NULL, NULL };
+  matcher_t **mp;
+  char *dir = ".", *snapfile = NULL, *path;
+  snapshot_t *snap = NULL;
+  uint32_t key = 0;
+  walker_t *w;
+  usage_t total = { 0, 0, 0 };
+  entry_t top;
+  struct stat st;
+  size_t len;
 
   C_error_init(*argv);
 
   /* parse the command line */
 
-  while((c = getopt(argc, argv, "ht:")) != EOF)
+  while((c = getopt(argc, argv, "hj:t:sd:L:xe:i:gUc:uJ0D")) != EOF)
   {
     switch(c)
     {
@@ -80,11 +747,99 @@ int main(int argc, char **argv)
         exit(EXIT_SUCCESS);
         break;
 
+      case 'j':
+        opts.jobs = atoi(optarg);
+        if(opts.jobs < 1 || opts.jobs > MAX_JOBS)
+        {
+          C_error_printf("Number of jobs must be between 1 and %i\n",
+                         MAX_JOBS);
+          errflag = TRUE;
+        }
+        break;
+
+      case 's':
+        show_usage = TRUE;
+        break;
+
+      case 'd':
+        c = atoi(optarg);
+        if(c < 1)
+        {
+          C_error_printf("Display depth must be >= 1\n");
+          errflag = TRUE;
+        }
+        else
+          max_display = c;
+        break;
+
+      case 'L':
+        c = atoi(optarg);
+        if(c < 1)
+        {
+          C_error_printf("Traversal depth must be >= 1\n");
+          errflag = TRUE;
+        }
+        else
+          opts.max_depth = c;
+        break;
+
+      case 'x':
+        opts.flags |= WALK_XDEV;
+        break;
+
+      case 'g':
+        graphics = TRUE;
+        break;
+
+      case 'U':
+        opts.flags &= ~WALK_SORT;
+        break;
+
+      case 'e':
+      case 'i':
+        mp = (c == 'e' ? &opts.exclude : &opts.include);
+        if(!*mp)
+          *mp = matcher_create();
+        if(!matcher_add(*mp, optarg))
+        {
+          C_error_printf("Invalid pattern: %s\n", optarg);
+          errflag = TRUE;
+        }
+        key = snap_hash(key, &c, sizeof(c));
+        key = snap_hash(key, optarg, strlen(optarg) + 1);
+        break;
+
+      case 'c':
+        snapfile = optarg;
+        break;
+
+      case 'u':
+#if defined(HAVE_LIBURING) && defined(HAVE_STATX)
+        opts.flags |= WALK_URING;
+#else
+        C_error_printf("Warning: built without io_uring support; "
+                       "ignoring -u\n");
+#endif
+        break;
+
+      case 'J':
+        format = FMT_JSON;
+        break;
+
+      case '0':
+        format = FMT_NUL;
+        break;
+
+      case 'D':
+        format = FMT_DUPES;
+        break;
+
       case 't':
         tab = atoi(optarg);
-        if(tab < 1 || tab > 8)
+        if(tab < 1 || tab > MAX_TABWIDTH)
         {
-          C_error_printf("Tab width must be >= 1 and <= 8)\n");
+          C_error_printf("Tab width must be >= 1 and <= %i)\n",
+                         MAX_TABWIDTH);
           errflag = TRUE;
         }
         else
@@ -97,6 +852,12 @@ int main(int argc, char **argv)
     }
   }
 
+  if(show_usage && ((format == FMT_NUL) || (format == FMT_DUPES)))
+  {
+    C_error_printf("-s can't be used with -0 or -D\n");
+    errflag = TRUE;
+  }
+
   /* catch illegal option errors */
 
   if(errflag)
@@ -118,9 +879,141 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  C_file_traverse(dir, examine, NULL);
+#ifndef HAVE_LIBPTHREAD
+  opts.jobs = 1;
+#endif
+
+  if(show_usage || (format == FMT_DUPES))
+    opts.flags |= WALK_STAT;
+
+  /* without usage totals, nothing below the display depth is needed */
+
+  if(!show_usage && (format != FMT_DUPES) && (max_display < UINT_MAX)
+     && (!opts.max_depth || (opts.max_depth > max_display)))
+    opts.max_depth = max_display;
+
+  init_glyphs(graphics);
+
+  if(snapfile)
+  {
+    /* the snapshot is only valid for the same directory and the options
+     * that decide which entries are recorded
+     */
+
+    if((path = realpath(dir, NULL)))
+    {
+      key = snap_hash(key, path, strlen(path) + 1);
+      free(path);
+    }
+
+    c = opts.flags & (WALK_XDEV | WALK_SORT);
+    key = snap_hash(key, &c, sizeof(c));
+    key = snap_hash(key, &(opts.max_depth), sizeof(opts.max_depth));
+
+    opts.snapshot = snap = snap_load(snapfile, key);
+    opts.flags |= WALK_MTIME;
+
+    /* the duplicate finder uses the snapshot, but doesn't record one */
+
+    if(format != FMT_DUPES)
+      snapw = snapw_create(key, time(NULL));
+  }
+
+  /* the top directory stands for itself in JSON, and starts every path
+   * with -0
+   */
+
+  memset(&top, 0, sizeof(top));
+  top.mode = S_IFDIR;
+  len = strlen(dir);
+  ok = TRUE;
+
+  if(format == FMT_JSON)
+    ok = json_open(dir, &top, "", TRUE);
+  else if((format == FMT_NUL) || (format == FMT_DUPES))
+  {
+    push_prefix(dir, len);
+    if(len && (dir[len - 1] != '/'))
+      push_prefix("/", 1);
+  }
+
+  w = walk_start(dir, &opts);
+
+  if(format == FMT_DUPES)
+  {
+    dupes_t *d = dupes_create();
+    c_bool_t started = FALSE;
+
+    collect(w, walk_root(w), d);
+    walk_finish(w);
+    ok = dupes_find(d, opts.jobs, emit_dupe, &started);
+    dupes_free(d);
+  }
+  else
+  {
+    if(ok)
+      ok = print_tree(w, walk_root(w), &total, SNAP_NONE);
+    walk_finish(w);
+  }
+
+  if(snap)
+    snap_free(snap);
+
+  if(snapw)
+  {
+    if(ok && !snapw_save(snapw, snapfile))
+      C_error_printf("Can't write snapshot: %s\n", snapfile);
+
+    snapw_free(snapw);
+  }
+
+  C_free(prefix);
+
+  if(opts.include)
+    matcher_free(opts.include);
+  if(opts.exclude)
+    matcher_free(opts.exclude);
+
+  /* the total for the whole tree includes the top directory itself */
+
+  if(ok && show_usage && (lstat(dir, &st) == 0))
+  {
+    top.size = st.st_size;
+    top.blocks = st.st_blocks;
+    account(&top, &total);
+  }
+
+  if(ok && (format == FMT_JSON))
+  {
+    if((ok = json_close(&top, &total, TRUE)))
+      obuf[olen++] = '\n';
+  }
+  else if(ok && show_usage)
+  {
+    /* finish with the total line */
+
+    if((ok = out_reserve(USAGE_COLS + len + 1)))
+    {
+      size_t cols = olen;
+
+      olen += USAGE_COLS;
+      memcpy(obuf + olen, dir, len);
+      olen += len;
+      obuf[olen++] = '\n';
+      put_usage(cols, &total, TRUE);
+    }
+  }
+
+  if(ok)
+    ok = out_flush();
+
+  if(ok && fflush(stdout) != 0)
+    ok = FALSE;
+
+  if(!ok)
+    C_error_syserr();
 
-  exit(EXIT_SUCCESS);
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 /* end of source file */
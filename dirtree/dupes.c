@@ -0,0 +1,551 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+/* The duplicate file finder. Files are compared in stages, each of which
+ * only looks at the files that the previous one could not tell apart:
+ *
+ *  1. by size, which the walker has already found;
+ *  2. by a hash of the first and last EDGE_SIZE bytes, which tells apart
+ *     most files that merely happen to have the same size, and for small
+ *     files covers the whole content;
+ *  3. by a hash of the whole content, read through mmap().
+ *
+ * The hashing stages run on a pool of threads. Empty files are ignored,
+ * and so are further links to a file already seen, since they are the
+ * same file rather than copies of it.
+ */
+
+/* --- Feature Test Switches --- */
+
+#include "config.h"
+
+/* --- System Headers --- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include <cbase/cbase.h>
+
+/* --- Local Headers --- */
+
+#include "dupes.h"
+
+/* --- Macros --- */
+
+#define EDGE_SIZE 4096             /* bytes hashed at each end of a file */
+#define CHUNK_SIZE (1024 * 1024)   /* whole files are hashed in chunks of
+                                      this size */
+#define INITIAL_FILES 1024
+#define INITIAL_PATHS (64 * 1024)
+#define BATCH 16                   /* files claimed by a thread at once */
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define ROTL(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+
+/* --- Types --- */
+
+typedef struct
+{
+  uint64_t size;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t hash;           /* of the ends of the file, then of all of it */
+  size_t path;             /* offset of the path in the path buffer */
+  size_t order;            /* the order in which the file was found */
+  c_bool_t ok;             /* FALSE once the file has failed to read */
+} file_t;
+
+struct dupes_t
+{
+  file_t *files;
+  size_t nfiles;
+  size_t filecap;
+  char *paths;
+  size_t pathlen;
+  size_t pathcap;
+};
+
+typedef void (*stage_t)(const dupes_t *d, file_t *f);
+
+/* Work shared by the threads running a stage. */
+
+typedef struct
+{
+  const dupes_t *d;
+  stage_t stage;
+  size_t next;             /* the next file to be claimed */
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} pool_t;
+
+/* --- Functions --- */
+
+static uint64_t read64(const unsigned char *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return(v);
+}
+
+/*
+ */
+
+static uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return(v);
+}
+
+/*
+ */
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME2;
+  acc = ROTL(acc, 31);
+  return(acc * PRIME1);
+}
+
+/*
+ */
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+  acc ^= xxh_round(0, val);
+  return((acc * PRIME1) + PRIME4);
+}
+
+/* The XXH64 hash, which runs at close to memory speed.
+ */
+
+static uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + len;
+  uint64_t h;
+
+  if(len >= 32)
+  {
+    uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2;
+    uint64_t v3 = seed, v4 = seed - PRIME1;
+
+    for(; p + 32 <= end; p += 32)
+    {
+      v1 = xxh_round(v1, read64(p));
+      v2 = xxh_round(v2, read64(p + 8));
+      v3 = xxh_round(v3, read64(p + 16));
+      v4 = xxh_round(v4, read64(p + 24));
+    }
+
+    h = ROTL(v1, 1) + ROTL(v2, 7) + ROTL(v3, 12) + ROTL(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  }
+  else
+    h = seed + PRIME5;
+
+  h += len;
+
+  for(; p + 8 <= end; p += 8)
+  {
+    h ^= xxh_round(0, read64(p));
+    h = (ROTL(h, 27) * PRIME1) + PRIME4;
+  }
+
+  if(p + 4 <= end)
+  {
+    h ^= (uint64_t)read32(p) * PRIME1;
+    h = (ROTL(h, 23) * PRIME2) + PRIME3;
+    p += 4;
+  }
+
+  for(; p < end; ++p)
+  {
+    h ^= *p * PRIME5;
+    h = ROTL(h, 11) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+
+  return(h);
+}
+
+/*
+ */
+
+dupes_t *dupes_create(void)
+{
+  return(C_new(dupes_t));
+}
+
+/* Add a regular file.
+ */
+
+void dupes_add(dupes_t *d, const char *path, size_t len, uint64_t size,
+               uint64_t dev, uint64_t ino)
+{
+  file_t *f;
+
+  if(d->nfiles == d->filecap)
+  {
+    d->filecap = (d->filecap ? d->filecap * 2 : INITIAL_FILES);
+    d->files = C_realloc(d->files, d->filecap, file_t);
+  }
+
+  if(d->pathlen + len + 1 > d->pathcap)
+  {
+    do
+      d->pathcap = (d->pathcap ? d->pathcap * 2 : INITIAL_PATHS);
+    while(d->pathlen + len + 1 > d->pathcap);
+
+    d->paths = C_realloc(d->paths, d->pathcap, char);
+  }
+
+  f = &(d->files[d->nfiles]);
+  f->size = size;
+  f->dev = dev;
+  f->ino = ino;
+  f->hash = 0;
+  f->path = d->pathlen;
+  f->order = d->nfiles++;
+  f->ok = TRUE;
+
+  memcpy(d->paths + d->pathlen, path, len);
+  d->paths[d->pathlen + len] = '\0';
+  d->pathlen += len + 1;
+}
+
+/* Stage 2: hash the first and last EDGE_SIZE bytes of a file, or all of it
+ * if it is no bigger than that.
+ */
+
+static void hash_ends(const dupes_t *d, file_t *f)
+{
+  unsigned char buf[EDGE_SIZE * 2];
+  size_t head = (f->size < EDGE_SIZE ? f->size : EDGE_SIZE), tail = 0;
+  int fd;
+
+  if((fd = open(d->paths + f->path, O_RDONLY)) < 0)
+  {
+    f->ok = FALSE;
+    return;
+  }
+
+  if(f->size > EDGE_SIZE)
+    tail = ((f->size - EDGE_SIZE) < EDGE_SIZE ? f->size - EDGE_SIZE
+            : EDGE_SIZE);
+
+  if((pread(fd, buf, head, 0) != (ssize_t)head)
+     || (tail && (pread(fd, buf + head, tail, f->size - tail)
+                  != (ssize_t)tail)))
+    f->ok = FALSE;
+  else
+    f->hash = xxh64(buf, head + tail, 0);
+
+  close(fd);
+}
+
+/* Stage 3: hash the whole of a file. The hash of each chunk is the seed
+ * for the next, so that mapped and read files hash alike.
+ */
+
+static void hash_all(const dupes_t *d, file_t *f)
+{
+  struct stat st;
+  unsigned char *map, *buf;
+  uint64_t h = 0, off;
+  size_t n;
+  int fd;
+
+  /* the ends covered everything */
+
+  if(f->size <= EDGE_SIZE * 2)
+    return;
+
+  if((fd = open(d->paths + f->path, O_RDONLY)) < 0)
+  {
+    f->ok = FALSE;
+    return;
+  }
+
+  /* a file that has changed size since it was found might shrink while it
+   * is mapped, and touching a page past its end would be fatal
+   */
+
+  if((fstat(fd, &st) != 0) || ((uint64_t)st.st_size != f->size))
+  {
+    f->ok = FALSE;
+    close(fd);
+    return;
+  }
+
+  map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if(map != MAP_FAILED)
+  {
+#ifdef MADV_SEQUENTIAL
+    madvise(map, f->size, MADV_SEQUENTIAL);
+#endif
+
+    for(off = 0; off < f->size; off += n)
+    {
+      n = ((f->size - off) < CHUNK_SIZE ? f->size - off : CHUNK_SIZE);
+      h = xxh64(map + off, n, h);
+    }
+
+    munmap(map, f->size);
+  }
+  else
+  {
+    /* too big to map, or an unmappable filesystem */
+
+    buf = C_malloc(CHUNK_SIZE, unsigned char);
+
+    for(off = 0; off < f->size; off += n)
+    {
+      n = ((f->size - off) < CHUNK_SIZE ? f->size - off : CHUNK_SIZE);
+      if(pread(fd, buf, n, off) != (ssize_t)n)
+      {
+        f->ok = FALSE;
+        break;
+      }
+
+      h = xxh64(buf, n, h);
+    }
+
+    C_free(buf);
+  }
+
+  f->hash = h;
+  close(fd);
+}
+
+/* Claim and process files until there are none left.
+ */
+
+static void *pool_work(void *arg)
+{
+  pool_t *pool = (pool_t *)arg;
+  size_t i, first, last;
+
+  for(;;)
+  {
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_lock(&(pool->lock));
+#endif
+    first = pool->next;
+    last = first + BATCH;
+    if(last > pool->d->nfiles)
+      last = pool->d->nfiles;
+    pool->next = last;
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_unlock(&(pool->lock));
+#endif
+
+    if(first >= last)
+      break;
+
+    for(i = first; i < last; ++i)
+      pool->stage(pool->d, &(pool->d->files[i]));
+  }
+
+  return(NULL);
+}
+
+/* Run a stage over all of the files, on the given number of threads.
+ */
+
+static void run_stage(dupes_t *d, stage_t stage, int jobs)
+{
+  pool_t pool;
+
+  pool.d = d;
+  pool.stage = stage;
+  pool.next = 0;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_init(&(pool.lock), NULL);
+
+  if(jobs > 1)
+  {
+    pthread_t *threads = C_newa(jobs, pthread_t);
+    int i;
+
+    for(i = 0; i < jobs; ++i)
+      pthread_create(&(threads[i]), NULL, pool_work, &pool);
+
+    for(i = 0; i < jobs; ++i)
+      pthread_join(threads[i], NULL);
+
+    C_free(threads);
+  }
+  else
+#endif
+    pool_work(&pool);
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_destroy(&(pool.lock));
+#endif
+}
+
+/*
+ */
+
+static int cmp_size(const void *a, const void *b)
+{
+  const file_t *fa = (const file_t *)a, *fb = (const file_t *)b;
+
+  if(fa->size != fb->size)
+    return(fa->size < fb->size ? -1 : 1);
+  if(fa->dev != fb->dev)
+    return(fa->dev < fb->dev ? -1 : 1);
+  if(fa->ino != fb->ino)
+    return(fa->ino < fb->ino ? -1 : 1);
+
+  return(fa->order < fb->order ? -1 : (fa->order > fb->order));
+}
+
+/* Order by size, largest first, then by hash, then in the order found.
+ */
+
+static int cmp_hash(const void *a, const void *b)
+{
+  const file_t *fa = (const file_t *)a, *fb = (const file_t *)b;
+
+  if(fa->size != fb->size)
+    return(fa->size > fb->size ? -1 : 1);
+  if(fa->hash != fb->hash)
+    return(fa->hash < fb->hash ? -1 : 1);
+
+  return(fa->order < fb->order ? -1 : (fa->order > fb->order));
+}
+
+/* Keep only the readable files that share their size and hash with
+ * another, given that the files are sorted so that these are adjacent.
+ */
+
+static void keep_groups(dupes_t *d)
+{
+  size_t i, j, k, n = 0;
+
+  for(i = 0; i < d->nfiles; i = j)
+  {
+    for(j = i + 1; (j < d->nfiles) && (d->files[j].size == d->files[i].size)
+          && (d->files[j].hash == d->files[i].hash); ++j)
+      ;
+
+    for(k = i; k < j; ++k)
+    {
+      if(!d->files[k].ok)
+        continue;
+
+      if(j - i > 1)
+        d->files[n++] = d->files[k];
+    }
+  }
+
+  d->nfiles = n;
+}
+
+/* Find the groups of identical files, and pass them to emit, the largest
+ * first.
+ */
+
+c_bool_t dupes_find(dupes_t *d, int jobs, dupes_emit_t emit, void *arg)
+{
+  size_t i, n;
+  c_bool_t ok = TRUE;
+
+  /* stage 1: drop empty files and extra links, then the unique sizes */
+
+  qsort(d->files, d->nfiles, sizeof(file_t), cmp_size);
+
+  for(i = n = 0; i < d->nfiles; ++i)
+  {
+    const file_t *f = &(d->files[i]);
+
+    if((f->size == 0) || (n && (d->files[n - 1].size == f->size)
+                          && (d->files[n - 1].dev == f->dev)
+                          && (d->files[n - 1].ino == f->ino)))
+      continue;
+
+    d->files[n++] = *f;
+  }
+
+  d->nfiles = n;
+  keep_groups(d);
+
+  /* stages 2 and 3 */
+
+  run_stage(d, hash_ends, jobs);
+  qsort(d->files, d->nfiles, sizeof(file_t), cmp_hash);
+  keep_groups(d);
+
+  run_stage(d, hash_all, jobs);
+  qsort(d->files, d->nfiles, sizeof(file_t), cmp_hash);
+  keep_groups(d);
+
+  for(i = 0; ok && (i < d->nfiles); ++i)
+  {
+    c_bool_t first = ((i == 0) || (d->files[i].size != d->files[i - 1].size)
+                      || (d->files[i].hash != d->files[i - 1].hash));
+
+    ok = emit(d->paths + d->files[i].path, first, arg);
+  }
+
+  return(ok);
+}
+
+/*
+ */
+
+void dupes_free(dupes_t *d)
+{
+  C_free(d->files);
+  C_free(d->paths);
+  C_free(d);
+}
+
+/* end of source file */
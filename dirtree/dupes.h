@@ -0,0 +1,46 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __DIRTREE_DUPES_H
+#define __DIRTREE_DUPES_H
+
+#include <stdint.h>
+
+typedef struct dupes_t dupes_t;
+
+/* Called for each file in each group of duplicates; first is TRUE for the
+ * first file of a group. Returns FALSE to stop.
+ */
+
+typedef c_bool_t (*dupes_emit_t)(const char *path, c_bool_t first,
+                                 void *arg);
+
+extern dupes_t *dupes_create(void);
+extern void dupes_add(dupes_t *d, const char *path, size_t len,
+                      uint64_t size, uint64_t dev, uint64_t ino);
+extern c_bool_t dupes_find(dupes_t *d, int jobs, dupes_emit_t emit,
+                           void *arg);
+extern void dupes_free(dupes_t *d);
+
+#endif /* __DIRTREE_DUPES_H */
+
+/* end of header file */
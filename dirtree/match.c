@@ -0,0 +1,435 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+/* Filename pattern matching. Each shell-style pattern (with `*', `?' and
+ * `[...]' classes) is compiled once into a sequence of operations, with
+ * bracket expressions expanded into 256-bit sets, so that matching never
+ * re-parses the pattern. Patterns without wildcards are kept in a hash
+ * table, and patterns of the form `*literal' and `literal*' are checked as
+ * simple suffix and prefix comparisons.
+ */
+
+/* --- Feature Test Switches --- */
+
+#include "config.h"
+
+/* --- System Headers --- */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <cbase/cbase.h>
+
+/* --- Local Headers --- */
+
+#include "match.h"
+
+/* --- Macros --- */
+
+#define INITIAL_EXACT 16
+
+#define SET_HAS(S, C) ((S)[(unsigned char)(C) >> 5]                     \
+                       & ((uint32_t)1 << ((unsigned char)(C) & 31)))
+#define SET_ADD(S, C) ((S)[(unsigned char)(C) >> 5]                     \
+                       |= ((uint32_t)1 << ((unsigned char)(C) & 31)))
+
+/* --- Types --- */
+
+typedef enum { OP_LITERAL, OP_ANY, OP_STAR, OP_SET } opcode_t;
+
+typedef struct
+{
+  opcode_t code;
+  const char *lit;         /* OP_LITERAL: the text, and its length */
+  size_t len;
+  uint32_t set[8];         /* OP_SET: the bytes that match */
+} op_t;
+
+typedef enum { PAT_PREFIX, PAT_SUFFIX, PAT_GENERAL } kind_t;
+
+typedef struct
+{
+  kind_t kind;
+  char *text;              /* the literal, for PAT_PREFIX and PAT_SUFFIX;
+                              literal text of the ops, for PAT_GENERAL */
+  size_t len;
+  op_t *ops;
+  size_t nops;
+} pattern_t;
+
+struct matcher_t
+{
+  char **exact;            /* open-addressed hash table of literal names */
+  size_t nexact;
+  size_t exactsz;          /* a power of two, or 0 */
+  pattern_t *pats;
+  size_t npats;
+};
+
+/* --- Functions --- */
+
+static size_t hash_name(const char *s)
+{
+  size_t h = 2166136261U;
+
+  while(*s)
+    h = (h ^ (unsigned char)*s++) * 16777619U;
+
+  return(h);
+}
+
+/*
+ */
+
+static void exact_add(matcher_t *m, char *name)
+{
+  size_t i;
+
+  if((m->nexact + 1) * 2 > m->exactsz)
+  {
+    char **old = m->exact;
+    size_t oldsz = m->exactsz;
+
+    m->exactsz = (m->exactsz ? m->exactsz * 2 : INITIAL_EXACT);
+    m->exact = C_newa(m->exactsz, char *);
+    m->nexact = 0;
+
+    for(i = 0; i < oldsz; ++i)
+    {
+      if(old[i])
+        exact_add(m, old[i]);
+    }
+
+    C_free(old);
+  }
+
+  for(i = hash_name(name) & (m->exactsz - 1);
+      m->exact[i];
+      i = (i + 1) & (m->exactsz - 1))
+  {
+    if(!strcmp(m->exact[i], name))
+    {
+      C_free(name);
+      return;
+    }
+  }
+
+  m->exact[i] = name;
+  ++m->nexact;
+}
+
+/* Parse a bracket expression starting just after the `['. Returns a
+ * pointer just past the closing `]', or NULL if there is none.
+ */
+
+static const char *parse_set(const char *p, uint32_t *set)
+{
+  c_bool_t negate = FALSE;
+  const char *start;
+  int i;
+
+  memset(set, 0, 8 * sizeof(uint32_t));
+
+  if((*p == '!') || (*p == '^'))
+    negate = TRUE, ++p;
+
+  /* a `]' first in the set is literal */
+
+  for(start = p; *p && ((*p != ']') || (p == start));)
+  {
+    unsigned char lo, hi;
+
+    /* a backslash quotes the next character, as it does outside a set */
+
+    if((*p == '\\') && p[1])
+      ++p;
+    lo = hi = (unsigned char)*p++;
+
+    if((*p == '-') && p[1] && (p[1] != ']'))
+    {
+      ++p;
+      if((*p == '\\') && p[1])
+        ++p;
+      hi = (unsigned char)*p++;
+    }
+
+    for(i = lo; i <= hi; ++i)
+      SET_ADD(set, i);
+  }
+
+  if(!*p)
+    return(NULL);
+
+  if(negate)
+  {
+    for(i = 0; i < 8; ++i)
+      set[i] = ~set[i];
+  }
+
+  return(p + 1);
+}
+
+/* Compile a pattern into a list of operations. Literal text is copied,
+ * unescaped, into a buffer that the literal ops point into.
+ */
+
+static c_bool_t compile(pattern_t *pat, const char *s)
+{
+  size_t n = strlen(s);
+  char *t = C_malloc(n + 1, char);
+  op_t *ops = C_newa(n + 1, op_t);
+  size_t nops = 0, tlen = 0;
+  const char *p = s;
+
+  while(*p)
+  {
+    op_t *op = &(ops[nops]);
+
+    switch(*p)
+    {
+      case '*':
+        /* consecutive stars are the same as one */
+
+        if(!nops || (ops[nops - 1].code != OP_STAR))
+          ops[nops++].code = OP_STAR;
+        ++p;
+        break;
+
+      case '?':
+        op->code = OP_ANY;
+        ++nops, ++p;
+        break;
+
+      case '[':
+        if(!(p = parse_set(p + 1, op->set)))
+        {
+          C_free(t);
+          C_free(ops);
+          return(FALSE);
+        }
+        op->code = OP_SET;
+        ++nops;
+        break;
+
+      default:
+        if((*p == '\\') && p[1])
+          ++p;
+
+        if(!nops || (ops[nops - 1].code != OP_LITERAL)
+           || (ops[nops - 1].lit + ops[nops - 1].len != t + tlen))
+        {
+          op->code = OP_LITERAL;
+          op->lit = t + tlen;
+          op->len = 0;
+          ++nops;
+        }
+
+        t[tlen++] = *p++;
+        ++ops[nops - 1].len;
+        break;
+    }
+  }
+
+  t[tlen] = '\0';
+  pat->text = t;
+  pat->len = tlen;
+  pat->ops = ops;
+  pat->nops = nops;
+  pat->kind = PAT_GENERAL;
+
+  if((nops == 2) && (ops[0].code == OP_STAR) && (ops[1].code == OP_LITERAL))
+    pat->kind = PAT_SUFFIX;
+  else if((nops == 2) && (ops[0].code == OP_LITERAL)
+          && (ops[1].code == OP_STAR))
+    pat->kind = PAT_PREFIX;
+
+  return(TRUE);
+}
+
+/* Match one operation against the start of s, returning the number of bytes
+ * consumed, or -1 if it does not match. Not used for OP_STAR.
+ */
+
+static int match_op(const op_t *op, const char *s)
+{
+  switch(op->code)
+  {
+    case OP_LITERAL:
+      return(strncmp(s, op->lit, op->len) ? -1 : (int)op->len);
+
+    case OP_ANY:
+      return(*s ? 1 : -1);
+
+    case OP_SET:
+      return((*s && SET_HAS(op->set, *s)) ? 1 : -1);
+
+    default:
+      return(-1);
+  }
+}
+
+/* Match a compiled pattern against a whole name. On a mismatch after a
+ * star, the star is made to absorb one more byte and matching resumes from
+ * the op after it; only the most recent star need be retried, so this
+ * takes at most O(pattern x name) steps.
+ */
+
+static c_bool_t match_general(const pattern_t *pat, const char *s)
+{
+  size_t i = 0, star = (size_t)-1;
+  const char *resume = NULL;
+
+  for(;;)
+  {
+    if(i < pat->nops)
+    {
+      const op_t *op = &(pat->ops[i]);
+      int k;
+
+      if(op->code == OP_STAR)
+      {
+        star = i++;
+        resume = s;
+        continue;
+      }
+
+      if((k = match_op(op, s)) >= 0)
+      {
+        ++i;
+        s += k;
+        continue;
+      }
+    }
+    else if(!*s)
+      return(TRUE);
+
+    /* backtrack to the last star */
+
+    if((star == (size_t)-1) || !*resume)
+      return(FALSE);
+
+    i = star + 1;
+    s = ++resume;
+  }
+}
+
+/*
+ */
+
+matcher_t *matcher_create(void)
+{
+  return(C_new(matcher_t));
+}
+
+/* Add a pattern. Returns FALSE if it is malformed.
+ */
+
+c_bool_t matcher_add(matcher_t *m, const char *pattern)
+{
+  pattern_t pat;
+
+  if(!compile(&pat, pattern))
+    return(FALSE);
+
+  if((pat.nops == 0) || ((pat.nops == 1) && (pat.ops[0].code == OP_LITERAL)))
+  {
+    exact_add(m, pat.text);
+    C_free(pat.ops);
+    return(TRUE);
+  }
+
+  m->pats = C_realloc(m->pats, m->npats + 1, pattern_t);
+  m->pats[m->npats++] = pat;
+
+  return(TRUE);
+}
+
+/* Test whether a name matches any of the patterns.
+ */
+
+c_bool_t matcher_match(const matcher_t *m, const char *name)
+{
+  size_t i, len = 0;
+
+  if(m->nexact > 0)
+  {
+    for(i = hash_name(name) & (m->exactsz - 1);
+        m->exact[i];
+        i = (i + 1) & (m->exactsz - 1))
+    {
+      if(!strcmp(m->exact[i], name))
+        return(TRUE);
+    }
+  }
+
+  for(i = 0; i < m->npats; ++i)
+  {
+    const pattern_t *pat = &(m->pats[i]);
+
+    switch(pat->kind)
+    {
+      case PAT_PREFIX:
+        if(!strncmp(name, pat->text, pat->len))
+          return(TRUE);
+        break;
+
+      case PAT_SUFFIX:
+        if(!len)
+          len = strlen(name);
+        if((len >= pat->len) && !memcmp(name + len - pat->len, pat->text,
+                                        pat->len))
+          return(TRUE);
+        break;
+
+      default:
+        if(match_general(pat, name))
+          return(TRUE);
+        break;
+    }
+  }
+
+  return(FALSE);
+}
+
+/*
+ */
+
+void matcher_free(matcher_t *m)
+{
+  size_t i;
+
+  for(i = 0; i < m->exactsz; ++i)
+    C_free(m->exact[i]);
+
+  for(i = 0; i < m->npats; ++i)
+  {
+    C_free(m->pats[i].text);
+    C_free(m->pats[i].ops);
+  }
+
+  C_free(m->exact);
+  C_free(m->pats);
+  C_free(m);
+}
+
+/* end of source file */
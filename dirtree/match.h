@@ -0,0 +1,35 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __DIRTREE_MATCH_H
+#define __DIRTREE_MATCH_H
+
+typedef struct matcher_t matcher_t;
+
+extern matcher_t *matcher_create(void);
+extern c_bool_t matcher_add(matcher_t *m, const char *pattern);
+extern c_bool_t matcher_match(const matcher_t *m, const char *name);
+extern void matcher_free(matcher_t *m);
+
+#endif /* __DIRTREE_MATCH_H */
+
+/* end of header file */
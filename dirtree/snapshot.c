@@ -0,0 +1,482 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+/* Tree snapshots. A snapshot records, for each directory that was listed,
+ * its parent, its name, its modification time, and the names and types of
+ * its entries; names are interned in a single string table, so that the
+ * many repeated names in a typical tree are stored once. On a later run, a
+ * directory whose modification time is unchanged need not be read again.
+ *
+ * A directory's modification time only says that it has not changed since
+ * that time; if it was modified again within the same clock tick after it
+ * was read, the time may not change. So a directory is only trusted if its
+ * recorded time is earlier than the start of the walk that recorded it.
+ *
+ * The file is written in the native byte order, and is rejected if the
+ * order, the format, or the key (a hash of the options that affect which
+ * entries are recorded) does not match.
+ */
+
+/* --- Feature Test Switches --- */
+
+#include "config.h"
+
+/* --- System Headers --- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <cbase/cbase.h>
+
+/* --- Local Headers --- */
+
+#include "snapshot.h"
+
+/* --- Macros --- */
+
+#define SNAP_MAGIC "DTSNAP\0\1"
+#define SNAP_ORDER 0x01020304U
+
+#define INITIAL_DIRS 256
+#define INITIAL_ENTRIES 4096
+#define INITIAL_STRINGS (64 * 1024)
+#define INITIAL_INDEX 1024
+
+/* --- Types --- */
+
+typedef struct
+{
+  char magic[8];
+  uint32_t order;          /* SNAP_ORDER, as written */
+  uint32_t key;
+  int64_t started;         /* when the walk began */
+  uint32_t ndirs;
+  uint32_t nentries;
+  uint32_t strsize;
+  uint32_t reserved;
+} header_t;
+
+typedef struct
+{
+  int64_t mtime;
+  uint32_t nsec;
+  uint32_t parent;         /* index of the parent, or SNAP_NONE */
+  uint32_t name;           /* offset in the string table */
+  uint32_t first;          /* index of the first entry */
+  uint32_t count;
+  uint32_t reserved;
+} sdir_t;
+
+typedef struct
+{
+  uint32_t name;
+  uint32_t mode;
+} sentry_t;
+
+struct snapshot_t
+{
+  header_t hdr;
+  sdir_t *dirs;
+  sentry_t *entries;
+  char *strs;
+  uint32_t *index;         /* open-addressed hash of directories by parent
+                              and name */
+  size_t indexsz;          /* a power of two */
+};
+
+struct snapwriter_t
+{
+  header_t hdr;
+  sdir_t *dirs;
+  size_t dircap;
+  sentry_t *entries;
+  size_t entcap;
+  char *strs;
+  size_t strcap;
+  uint32_t *index;         /* open-addressed hash of string offsets */
+  size_t indexsz;          /* a power of two */
+  size_t nstrs;
+};
+
+/* --- Functions --- */
+
+/* FNV-1a, for hashing names and keys.
+ */
+
+uint32_t snap_hash(uint32_t h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+
+  if(!h)
+    h = 2166136261U;
+
+  while(len--)
+    h = (h ^ *p++) * 16777619U;
+
+  return(h);
+}
+
+/*
+ */
+
+static uint32_t child_hash(uint32_t parent, const char *name)
+{
+  return(snap_hash(snap_hash(0, &parent, sizeof(parent)), name,
+                   strlen(name)));
+}
+
+/* Read a snapshot, returning NULL if there is none or it does not match.
+ */
+
+snapshot_t *snap_load(const char *file, uint32_t key)
+{
+  snapshot_t *s;
+  FILE *fp;
+  struct stat st;
+  c_bool_t ok;
+  uint32_t i, j, n;
+
+  if(!(fp = fopen(file, "rb")))
+    return(NULL);
+
+  s = C_new(snapshot_t);
+
+  ok = ((fread(&(s->hdr), sizeof(header_t), 1, fp) == 1)
+        && !memcmp(s->hdr.magic, SNAP_MAGIC, sizeof(s->hdr.magic))
+        && (s->hdr.order == SNAP_ORDER) && (s->hdr.key == key)
+        && (s->hdr.ndirs > 0) && (s->hdr.strsize > 0));
+
+  /* the counts in the header must account for the file's exact size
+   * before anything is allocated from them
+   */
+
+  ok = (ok && (fstat(fileno(fp), &st) == 0)
+        && ((size_t)st.st_size == sizeof(header_t)
+            + ((size_t)s->hdr.ndirs * sizeof(sdir_t))
+            + ((size_t)s->hdr.nentries * sizeof(sentry_t))
+            + (size_t)s->hdr.strsize));
+
+  if(ok)
+  {
+    s->dirs = C_malloc(s->hdr.ndirs, sdir_t);
+    s->entries = C_malloc((size_t)s->hdr.nentries + 1, sentry_t);
+    s->strs = C_malloc(s->hdr.strsize, char);
+
+    ok = ((fread(s->dirs, sizeof(sdir_t), s->hdr.ndirs, fp)
+           == s->hdr.ndirs)
+          && (fread(s->entries, sizeof(sentry_t), s->hdr.nentries, fp)
+              == s->hdr.nentries)
+          && (fread(s->strs, 1, s->hdr.strsize, fp) == s->hdr.strsize)
+          && (s->strs[s->hdr.strsize - 1] == '\0'));
+  }
+
+  fclose(fp);
+
+  /* check that every index is in range, so that a damaged file can't send
+   * the lookups astray
+   */
+
+  for(i = 0; ok && (i < s->hdr.ndirs); ++i)
+  {
+    const sdir_t *d = &(s->dirs[i]);
+
+    ok = (((i == 0) ? (d->parent == SNAP_NONE) : (d->parent < i))
+          && (d->name < s->hdr.strsize) && (d->first <= s->hdr.nentries)
+          && (d->count <= s->hdr.nentries - d->first));
+  }
+
+  for(i = 0; ok && (i < s->hdr.nentries); ++i)
+    ok = (s->entries[i].name < s->hdr.strsize);
+
+  if(!ok)
+  {
+    snap_free(s);
+    return(NULL);
+  }
+
+  /* index the directories by parent and name */
+
+  for(s->indexsz = INITIAL_INDEX; s->indexsz < s->hdr.ndirs * 2;
+      s->indexsz *= 2)
+    ;
+
+  s->index = C_malloc(s->indexsz, uint32_t);
+  memset(s->index, 0xFF, s->indexsz * sizeof(uint32_t));
+
+  for(i = 1, n = s->hdr.ndirs; i < n; ++i)
+  {
+    for(j = child_hash(s->dirs[i].parent, s->strs + s->dirs[i].name)
+          & (s->indexsz - 1);
+        s->index[j] != SNAP_NONE;
+        j = (j + 1) & (s->indexsz - 1))
+      ;
+
+    s->index[j] = i;
+  }
+
+  return(s);
+}
+
+/*
+ */
+
+uint32_t snap_root(const snapshot_t *s)
+{
+  return(s ? 0 : SNAP_NONE);
+}
+
+/* Test whether a directory can be taken from the snapshot, given its
+ * current modification time.
+ */
+
+c_bool_t snap_fresh(const snapshot_t *s, uint32_t dir, time_t mtime,
+                    long nsec)
+{
+  const sdir_t *d = &(s->dirs[dir]);
+
+  return((d->mtime == (int64_t)mtime) && (d->nsec == (uint32_t)nsec)
+         && (d->mtime < s->hdr.started));
+}
+
+/*
+ */
+
+size_t snap_count(const snapshot_t *s, uint32_t dir)
+{
+  return(s->dirs[dir].count);
+}
+
+/* Get the name and type of a directory's i'th entry.
+ */
+
+const char *snap_entry(const snapshot_t *s, uint32_t dir, size_t i,
+                       mode_t *mode)
+{
+  const sentry_t *e = &(s->entries[s->dirs[dir].first + i]);
+
+  *mode = (mode_t)e->mode;
+  return(s->strs + e->name);
+}
+
+/* Find a subdirectory in the snapshot.
+ */
+
+uint32_t snap_child(const snapshot_t *s, uint32_t dir, const char *name)
+{
+  uint32_t j, i;
+
+  for(j = child_hash(dir, name) & (s->indexsz - 1);
+      (i = s->index[j]) != SNAP_NONE;
+      j = (j + 1) & (s->indexsz - 1))
+  {
+    if((s->dirs[i].parent == dir) && !strcmp(s->strs + s->dirs[i].name,
+                                             name))
+      return(i);
+  }
+
+  return(SNAP_NONE);
+}
+
+/*
+ */
+
+void snap_free(snapshot_t *s)
+{
+  C_free(s->dirs);
+  C_free(s->entries);
+  C_free(s->strs);
+  C_free(s->index);
+  C_free(s);
+}
+
+/*
+ */
+
+snapwriter_t *snapw_create(uint32_t key, time_t started)
+{
+  snapwriter_t *sw = C_new(snapwriter_t);
+
+  memcpy(sw->hdr.magic, SNAP_MAGIC, sizeof(sw->hdr.magic));
+  sw->hdr.order = SNAP_ORDER;
+  sw->hdr.key = key;
+  sw->hdr.started = started;
+
+  return(sw);
+}
+
+/* Add a name to the string table, if it is not already there, and return
+ * its offset.
+ */
+
+static uint32_t intern(snapwriter_t *sw, const char *name)
+{
+  size_t len = strlen(name) + 1, i;
+  uint32_t off;
+
+  if((sw->nstrs + 1) * 2 > sw->indexsz)
+  {
+    sw->indexsz = (sw->indexsz ? sw->indexsz * 2 : INITIAL_INDEX);
+    sw->index = C_realloc(sw->index, sw->indexsz, uint32_t);
+    memset(sw->index, 0xFF, sw->indexsz * sizeof(uint32_t));
+
+    /* the strings are packed end to end, so they can be re-indexed by
+     * walking the table
+     */
+
+    for(off = 0; off < sw->hdr.strsize;
+        off += strlen(sw->strs + off) + 1)
+    {
+      for(i = snap_hash(0, sw->strs + off, strlen(sw->strs + off))
+            & (sw->indexsz - 1);
+          sw->index[i] != SNAP_NONE;
+          i = (i + 1) & (sw->indexsz - 1))
+        ;
+
+      sw->index[i] = off;
+    }
+  }
+
+  for(i = snap_hash(0, name, len - 1) & (sw->indexsz - 1);
+      sw->index[i] != SNAP_NONE;
+      i = (i + 1) & (sw->indexsz - 1))
+  {
+    if(!strcmp(sw->strs + sw->index[i], name))
+      return(sw->index[i]);
+  }
+
+  if(sw->hdr.strsize + len > sw->strcap)
+  {
+    do
+      sw->strcap = (sw->strcap ? sw->strcap * 2 : INITIAL_STRINGS);
+    while(sw->hdr.strsize + len > sw->strcap);
+
+    sw->strs = C_realloc(sw->strs, sw->strcap, char);
+  }
+
+  off = sw->hdr.strsize;
+  memcpy(sw->strs + off, name, len);
+  sw->hdr.strsize += len;
+  sw->index[i] = off;
+  ++sw->nstrs;
+
+  return(off);
+}
+
+/* Record a directory; its entries must be added next. Returns its index.
+ */
+
+uint32_t snapw_dir(snapwriter_t *sw, uint32_t parent, const char *name,
+                   time_t mtime, long nsec)
+{
+  sdir_t *d;
+
+  if(sw->hdr.ndirs == sw->dircap)
+  {
+    sw->dircap = (sw->dircap ? sw->dircap * 2 : INITIAL_DIRS);
+    sw->dirs = C_realloc(sw->dirs, sw->dircap, sdir_t);
+  }
+
+  d = &(sw->dirs[sw->hdr.ndirs]);
+  memset(d, 0, sizeof(sdir_t));
+  d->mtime = mtime;
+  d->nsec = nsec;
+  d->parent = parent;
+  d->name = intern(sw, name);
+  d->first = sw->hdr.nentries;
+
+  return(sw->hdr.ndirs++);
+}
+
+/* Add an entry to the most recently recorded directory.
+ */
+
+void snapw_entry(snapwriter_t *sw, const char *name, mode_t mode)
+{
+  sentry_t *e;
+
+  if(sw->hdr.nentries == sw->entcap)
+  {
+    sw->entcap = (sw->entcap ? sw->entcap * 2 : INITIAL_ENTRIES);
+    sw->entries = C_realloc(sw->entries, sw->entcap, sentry_t);
+  }
+
+  e = &(sw->entries[sw->hdr.nentries++]);
+  e->name = intern(sw, name);
+  e->mode = mode;
+  ++sw->dirs[sw->hdr.ndirs - 1].count;
+}
+
+/* Write the snapshot. It is written to a temporary file which then
+ * replaces the old one, so that an interrupted run leaves the old snapshot
+ * intact.
+ */
+
+c_bool_t snapw_save(snapwriter_t *sw, const char *file)
+{
+  size_t len = strlen(file);
+  char *tmp = C_malloc(len + 5, char);
+  FILE *fp;
+  c_bool_t ok = FALSE;
+
+  memcpy(tmp, file, len);
+  strcpy(tmp + len, ".tmp");
+
+  if((fp = fopen(tmp, "wb")))
+  {
+    ok = ((fwrite(&(sw->hdr), sizeof(header_t), 1, fp) == 1)
+          && (fwrite(sw->dirs, sizeof(sdir_t), sw->hdr.ndirs, fp)
+              == sw->hdr.ndirs)
+          && (fwrite(sw->entries, sizeof(sentry_t), sw->hdr.nentries, fp)
+              == sw->hdr.nentries)
+          && (fwrite(sw->strs, 1, sw->hdr.strsize, fp)
+              == sw->hdr.strsize));
+
+    if(fclose(fp) != 0)
+      ok = FALSE;
+
+    if(ok)
+      ok = (rename(tmp, file) == 0);
+
+    if(!ok)
+      remove(tmp);
+  }
+
+  C_free(tmp);
+
+  return(ok);
+}
+
+/*
+ */
+
+void snapw_free(snapwriter_t *sw)
+{
+  C_free(sw->dirs);
+  C_free(sw->entries);
+  C_free(sw->strs);
+  C_free(sw->index);
+  C_free(sw);
+}
+
+/* end of source file */
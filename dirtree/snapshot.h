@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __DIRTREE_SNAPSHOT_H
+#define __DIRTREE_SNAPSHOT_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define SNAP_NONE ((uint32_t)-1)
+
+typedef struct snapshot_t snapshot_t;
+typedef struct snapwriter_t snapwriter_t;
+
+extern uint32_t snap_hash(uint32_t h, const void *data, size_t len);
+
+extern snapshot_t *snap_load(const char *file, uint32_t key);
+extern uint32_t snap_root(const snapshot_t *s);
+extern c_bool_t snap_fresh(const snapshot_t *s, uint32_t dir, time_t mtime,
+                           long nsec);
+extern size_t snap_count(const snapshot_t *s, uint32_t dir);
+extern const char *snap_entry(const snapshot_t *s, uint32_t dir, size_t i,
+                              mode_t *mode);
+extern uint32_t snap_child(const snapshot_t *s, uint32_t dir,
+                           const char *name);
+extern void snap_free(snapshot_t *s);
+
+extern snapwriter_t *snapw_create(uint32_t key, time_t started);
+extern uint32_t snapw_dir(snapwriter_t *sw, uint32_t parent,
+                          const char *name, time_t mtime, long nsec);
+extern void snapw_entry(snapwriter_t *sw, const char *name, mode_t mode);
+extern c_bool_t snapw_save(snapwriter_t *sw, const char *file);
+extern void snapw_free(snapwriter_t *sw);
+
+#endif /* __DIRTREE_SNAPSHOT_H */
+
+/* end of header file */
@@ -0,0 +1,1174 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+/* The directory walker. Each directory is represented by a node, which
+ * holds the entries read from it and a node for each subdirectory. Nodes
+ * are read on demand by walk_wait() in serial mode; in parallel mode, worker
+ * threads read them ahead of the caller, so that the caller still sees the
+ * tree in depth-first order but seldom has to wait for it.
+ *
+ * In parallel mode, each worker has its own deque of nodes to read. A
+ * worker pushes the subdirectories it finds onto the bottom of its own
+ * deque and pops from the bottom, so it works depth-first and keeps the
+ * set of pending nodes small; an idle worker steals from the top of
+ * another's deque, taking the shallowest (and so probably largest) piece of
+ * outstanding work. So that a slow caller doesn't leave the whole tree in
+ * memory, workers stop reading once READ_AHEAD entries have been read
+ * from directories not yet released; if the caller then needs a directory that no worker
+ * has started on, it reads that directory itself.
+ *
+ * Subdirectories are opened with openat() relative to an open descriptor
+ * on their parent, which saves the kernel from resolving the full path of
+ * every directory. The parent's descriptor is kept open until all of its
+ * subdirectories have been opened, within a fixed budget of descriptors;
+ * beyond that, directories are opened by their full paths.
+ *
+ * With WALK_URING, the entries of a directory that need to be stat'ed are
+ * stat'ed in batches through an io_uring, one ring per reader, so that the
+ * kernel can work on many of them at once rather than one per system call.
+ * If a ring can't be set up, or the kernel rejects the requests, entries
+ * are stat'ed one at a time as usual.
+ */
+
+/* --- Feature Test Switches --- */
+
+#include "config.h"
+
+/* --- System Headers --- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_STATX
+#include <sys/sysmacros.h>
+#endif
+
+#if defined(HAVE_LIBURING) && defined(HAVE_STATX)
+#define USE_URING
+#include <errno.h>
+#include <liburing.h>
+#endif
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include <cbase/cbase.h>
+
+/* --- Local Headers --- */
+
+#include "walk.h"
+
+/* --- Macros --- */
+
+#define MAX_OPEN_DIRS 256  /* directory descriptors kept open for openat() */
+#define READ_AHEAD 16384   /* entries read ahead of the caller */
+
+#define INITIAL_ENTRIES 16
+#define INITIAL_NAMES 256
+#define INITIAL_DEQUE 64
+#define RING_ENTRIES 64      /* stat requests submitted at once */
+
+#define STAT_MASK (STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_INO      \
+                   | STATX_NLINK)
+#define STAT_FLAGS (AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT)
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define MTIME_NSEC(ST) ((ST).st_mtim.tv_nsec)
+#else
+#define MTIME_NSEC(ST) 0
+#endif
+
+#ifdef HAVE_LIBPTHREAD
+
+#define LOCK(W)                                 \
+  if((W)->threads)                              \
+    pthread_mutex_lock(&((W)->lock))
+
+#define UNLOCK(W)                               \
+  if((W)->threads)                              \
+    pthread_mutex_unlock(&((W)->lock))
+
+#else
+
+#define LOCK(W)
+#define UNLOCK(W)
+
+#endif /* HAVE_LIBPTHREAD */
+
+/* --- Types --- */
+
+typedef struct ring_t ring_t;
+
+#ifdef USE_URING
+
+/* An io_uring for batched stats; usable by one thread at a time. */
+
+struct ring_t
+{
+  struct io_uring uring;
+  c_bool_t ok;             /* cleared if the ring stops working */
+  c_bool_t open;           /* cleared once the ring has been torn down */
+};
+
+#endif /* USE_URING */
+
+typedef struct
+{
+  const char *name;
+  size_t index;           /* of the entry in its node */
+} sortkey_t;
+
+#ifdef HAVE_LIBPTHREAD
+
+typedef struct
+{
+  node_t **items;         /* ring buffer; the top is at head */
+  size_t head;
+  size_t count;
+  size_t cap;
+  pthread_mutex_t lock;
+} deque_t;
+
+#endif /* HAVE_LIBPTHREAD */
+
+struct walker_t
+{
+  const char *path;       /* the root directory */
+  walkopts_t opts;
+  dev_t dev;              /* the root's device, for WALK_XDEV */
+  ring_t *ring;           /* for serial mode, with WALK_URING */
+  node_t *root;
+  uint_t nfds;            /* directory descriptors held open */
+#ifdef HAVE_LIBPTHREAD
+  int jobs;
+  pthread_t *threads;     /* NULL in serial mode */
+  struct worker_t *workers;
+  deque_t *deques;        /* one per worker */
+  pthread_mutex_t lock;   /* protects the fields below, node states, and
+                             descriptor reference counts */
+  pthread_cond_t work;    /* nodes have been queued */
+  pthread_cond_t done;    /* the awaited node has been read */
+  uint_t ntasks;          /* queued nodes not yet claimed by a worker */
+  size_t nread;           /* nodes read but not yet released, and their
+                             entries */
+  node_t *waiting;        /* the node the caller is waiting for */
+  c_bool_t shutdown;
+#endif
+};
+
+#ifdef HAVE_LIBPTHREAD
+
+typedef struct worker_t
+{
+  walker_t *walker;
+  int self;               /* index of this worker's deque */
+} worker_t;
+
+#endif /* HAVE_LIBPTHREAD */
+
+/* --- Functions --- */
+
+/* Find the type of a directory entry that readdir() could not tell us,
+ * asking for nothing but the type where statx() is available. Returns 0 if
+ * the entry has vanished or cannot be examined.
+ */
+
+static mode_t entry_type(int dfd, const char *name)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if(statx(dfd, name, STAT_FLAGS, STATX_TYPE, &stx) == 0)
+    return(stx.stx_mode & S_IFMT);
+#else
+  struct stat st;
+
+  if(fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+    return(st.st_mode & S_IFMT);
+#endif
+
+  return(0);
+}
+
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+
+/* Map a d_type value to the corresponding file type bits, or 0 if it is
+ * DT_UNKNOWN, as it may be on filesystems that do not record the type in
+ * the directory itself.
+ */
+
+static mode_t dtype_mode(unsigned char type)
+{
+  switch(type)
+  {
+    case DT_REG:
+      return(S_IFREG);
+    case DT_DIR:
+      return(S_IFDIR);
+    case DT_LNK:
+      return(S_IFLNK);
+    case DT_FIFO:
+      return(S_IFIFO);
+    case DT_SOCK:
+      return(S_IFSOCK);
+    case DT_CHR:
+      return(S_IFCHR);
+    case DT_BLK:
+      return(S_IFBLK);
+    default:
+      return(0);
+  }
+}
+
+#endif /* HAVE_STRUCT_DIRENT_D_TYPE */
+
+#ifdef HAVE_STATX
+
+/* Fill in an entry from the result of a statx(), and return its type.
+ */
+
+static mode_t statx_entry(const struct statx *stx, entry_t *e)
+{
+  e->size = stx->stx_size;
+  e->blocks = stx->stx_blocks;
+  e->ino = stx->stx_ino;
+  e->dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  e->nlink = stx->stx_nlink;
+
+  return(stx->stx_mode & S_IFMT);
+}
+
+#endif /* HAVE_STATX */
+
+/* Fill in the type, size and identity of a directory entry, asking for no
+ * more than that where statx() is available. Returns the type, or 0 if the
+ * entry has vanished or cannot be examined.
+ */
+
+static mode_t entry_stat(int dfd, const char *name, entry_t *e)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if(statx(dfd, name, STAT_FLAGS, STAT_MASK, &stx) != 0)
+    return(0);
+
+  return(statx_entry(&stx, e));
+#else
+  struct stat st;
+
+  if(fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    return(0);
+
+  e->size = st.st_size;
+  e->blocks = st.st_blocks;
+  e->ino = st.st_ino;
+  e->dev = st.st_dev;
+  e->nlink = st.st_nlink;
+
+  return(st.st_mode & S_IFMT);
+#endif
+}
+
+/*
+ */
+
+static node_t *node_create(node_t *parent, const char *name)
+{
+  node_t *node = C_new(node_t);
+
+  node->parent = parent;
+  node->name = name;
+  node->depth = (parent ? parent->depth + 1 : 0);
+  node->state = NODE_PENDING;
+  node->fd = -1;
+  node->snap = SNAP_NONE;
+
+  return(node);
+}
+
+/*
+ */
+
+static entry_t *node_add(node_t *node, const char *name, mode_t mode)
+{
+  size_t len = strlen(name) + 1;
+  entry_t *e;
+
+  if(node->nentries == node->entcap)
+  {
+    node->entcap = (node->entcap ? node->entcap * 2 : INITIAL_ENTRIES);
+    node->entries = C_realloc(node->entries, node->entcap, entry_t);
+  }
+
+  if(node->namelen + len > node->namecap)
+  {
+    do
+      node->namecap = (node->namecap ? node->namecap * 2 : INITIAL_NAMES);
+    while(node->namelen + len > node->namecap);
+
+    node->names = C_realloc(node->names, node->namecap, char);
+  }
+
+  e = &(node->entries[node->nentries++]);
+  memset(e, 0, sizeof(entry_t));
+  e->name = node->namelen;
+  e->mode = mode;
+
+  memcpy(node->names + node->namelen, name, len);
+  node->namelen += len;
+
+  return(e);
+}
+
+/*
+ */
+
+static int sortkey_cmp(const void *a, const void *b)
+{
+  return(strcmp(((const sortkey_t *)a)->name, ((const sortkey_t *)b)->name));
+}
+
+/* Sort a node's entries by name, in byte order. The names themselves stay
+ * where they are in the node's name buffer.
+ */
+
+static void node_sort(node_t *node)
+{
+  sortkey_t *keys;
+  entry_t *sorted;
+  size_t i;
+
+  if(node->nentries < 2)
+    return;
+
+  keys = C_malloc(node->nentries, sortkey_t);
+  for(i = 0; i < node->nentries; ++i)
+  {
+    keys[i].name = NODE_NAME(node, &(node->entries[i]));
+    keys[i].index = i;
+  }
+
+  qsort(keys, node->nentries, sizeof(sortkey_t), sortkey_cmp);
+
+  sorted = C_malloc(node->entcap, entry_t);
+  for(i = 0; i < node->nentries; ++i)
+    sorted[i] = node->entries[keys[i].index];
+
+  C_free(node->entries);
+  node->entries = sorted;
+  C_free(keys);
+}
+
+/* Build the full path of a node.
+ */
+
+static void node_path(walker_t *w, const node_t *node, char **buf,
+                      size_t *len, size_t *cap)
+{
+  const char *s = (node->parent ? node->name : w->path);
+  size_t n = strlen(s);
+
+  if(node->parent)
+  {
+    node_path(w, node->parent, buf, len, cap);
+    (*buf)[(*len)++] = '/';
+  }
+  else
+    *len = 0;
+
+  if(*len + n + 2 > *cap)
+  {
+    *cap = (*len + n + 2) * 2;
+    *buf = C_realloc(*buf, *cap, char);
+  }
+
+  memcpy(*buf + *len, s, n + 1);
+  *len += n;
+}
+
+/* Open a node's directory: relative to its parent's descriptor if that is
+ * still open, and by its full path otherwise.
+ */
+
+static int node_open(walker_t *w, node_t *node)
+{
+  node_t *parent = node->parent;
+  int fd;
+
+  if(!parent)
+    return(open(w->path, O_RDONLY | O_DIRECTORY));
+
+  if(parent->fd >= 0)
+    fd = openat(parent->fd, node->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  else
+  {
+    char *path = NULL;
+    size_t len, cap = 0;
+
+    node_path(w, node, &path, &len, &cap);
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    C_free(path);
+  }
+
+  /* release this node's hold on the parent's descriptor */
+
+  LOCK(w);
+  if((--parent->refs == 0) && (parent->fd >= 0))
+  {
+    close(parent->fd);
+    parent->fd = -1;
+    --w->nfds;
+  }
+  UNLOCK(w);
+
+  return(fd);
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ */
+
+static void deque_push(deque_t *dq, node_t *node)
+{
+  pthread_mutex_lock(&(dq->lock));
+
+  if(dq->count == dq->cap)
+  {
+    size_t i, cap = (dq->cap ? dq->cap * 2 : INITIAL_DEQUE);
+    node_t **items = C_malloc(cap, node_t *);
+
+    for(i = 0; i < dq->count; ++i)
+      items[i] = dq->items[(dq->head + i) % dq->cap];
+
+    C_free(dq->items);
+    dq->items = items;
+    dq->head = 0;
+    dq->cap = cap;
+  }
+
+  dq->items[(dq->head + dq->count++) % dq->cap] = node;
+
+  pthread_mutex_unlock(&(dq->lock));
+}
+
+/* Take a node from the bottom (the owner's end) or the top (a thief's end)
+ * of a deque, or return NULL if it is empty.
+ */
+
+static node_t *deque_take(deque_t *dq, c_bool_t bottom)
+{
+  node_t *node = NULL;
+
+  pthread_mutex_lock(&(dq->lock));
+
+  if(dq->count > 0)
+  {
+    if(bottom)
+      node = dq->items[(dq->head + --dq->count) % dq->cap];
+    else
+    {
+      node = dq->items[dq->head];
+      dq->head = (dq->head + 1) % dq->cap;
+      --dq->count;
+    }
+  }
+
+  pthread_mutex_unlock(&(dq->lock));
+
+  return(node);
+}
+
+#endif /* HAVE_LIBPTHREAD */
+
+/* Test whether an entry that has not been excluded should be listed: if
+ * there are include patterns, files must match one.
+ */
+
+static c_bool_t node_wants(walker_t *w, const char *name, mode_t mode)
+{
+  return(S_ISDIR(mode) || !w->opts.include
+         || matcher_match(w->opts.include, name));
+}
+
+#ifdef USE_URING
+
+/* Set up a ring, or return NULL if the kernel won't provide one.
+ */
+
+static ring_t *ring_create(void)
+{
+  ring_t *ring = C_new(ring_t);
+
+  if(io_uring_queue_init(RING_ENTRIES, &(ring->uring), 0) < 0)
+  {
+    C_free(ring);
+    return(NULL);
+  }
+
+  ring->ok = ring->open = TRUE;
+  return(ring);
+}
+
+/* Tear down a ring, cancelling any requests that are still in flight. The
+ * ring is not used again.
+ */
+
+static void ring_close(ring_t *ring)
+{
+  if(ring->open)
+    io_uring_queue_exit(&(ring->uring));
+
+  ring->ok = ring->open = FALSE;
+}
+
+/*
+ */
+
+static void ring_destroy(ring_t *ring)
+{
+  ring_close(ring);
+  C_free(ring);
+}
+
+/* Examine the entries of a node that were added without a type, as for
+ * entry_stat() or entry_type(), submitting up to RING_ENTRIES statx
+ * requests at a time. Requests that fail are retried with a plain system
+ * call, and once the ring has failed, the remaining entries are examined
+ * one at a time.
+ */
+
+static void ring_stat(walker_t *w, node_t *node, int dfd, ring_t *ring)
+{
+  struct statx stx[RING_ENTRIES];
+  size_t slot[RING_ENTRIES];   /* the entry for each request */
+  int res[RING_ENTRIES];
+  c_bool_t full = ((w->opts.flags & WALK_STAT) != 0);
+  size_t i = 0, n, k;
+  int r, done;
+
+  while(i < node->nentries)
+  {
+    for(n = 0; (i < node->nentries) && (n < RING_ENTRIES); ++i)
+    {
+      entry_t *e = &(node->entries[i]);
+      struct io_uring_sqe *sqe;
+
+      if(e->mode)
+        continue;
+
+      if(!ring->ok || !(sqe = io_uring_get_sqe(&(ring->uring))))
+      {
+        e->mode = (full ? entry_stat(dfd, NODE_NAME(node, e), e)
+                   : entry_type(dfd, NODE_NAME(node, e)));
+        continue;
+      }
+
+      io_uring_prep_statx(sqe, dfd, NODE_NAME(node, e), STAT_FLAGS,
+                          (full ? STAT_MASK : STATX_TYPE), &(stx[n]));
+      io_uring_sqe_set_data(sqe, &(stx[n]));
+      slot[n] = i;
+      res[n] = -EAGAIN;
+      ++n;
+    }
+
+    if(n == 0)
+      continue;
+
+    while((r = io_uring_submit_and_wait(&(ring->uring), n)) == -EINTR)
+      ;
+
+    /* if not everything was submitted, give up on the ring: the rest
+     * would otherwise go with the next batch
+     */
+
+    if(r < (int)n)
+      ring->ok = FALSE;
+
+    for(done = 0; done < r; ++done)
+    {
+      struct io_uring_cqe *cqe = NULL;
+      int err;
+
+      while((err = io_uring_wait_cqe(&(ring->uring), &cqe)) == -EINTR)
+        ;
+
+      /* the requests still in flight would write into stx after this
+       * function has returned, so they are cancelled along with the ring
+       */
+
+      if(err < 0)
+      {
+        ring_close(ring);
+        break;
+      }
+
+      k = (struct statx *)io_uring_cqe_get_data(cqe) - stx;
+      res[k] = cqe->res;
+      io_uring_cqe_seen(&(ring->uring), cqe);
+    }
+
+    for(k = 0; k < n; ++k)
+    {
+      entry_t *e = &(node->entries[slot[k]]);
+
+      if(res[k] == 0)
+        e->mode = (full ? statx_entry(&(stx[k]), e)
+                   : (stx[k].stx_mode & S_IFMT));
+      else
+      {
+        /* older kernels can't do statx through the ring */
+
+        if(res[k] == -EINVAL)
+          ring->ok = FALSE;
+
+        e->mode = (full ? entry_stat(dfd, NODE_NAME(node, e), e)
+                   : entry_type(dfd, NODE_NAME(node, e)));
+      }
+    }
+  }
+}
+
+/* Drop the entries that ring_stat() could not examine, or that the include
+ * patterns reject now that their types are known.
+ */
+
+static void node_compact(walker_t *w, node_t *node)
+{
+  size_t i, j;
+
+  for(i = j = 0; i < node->nentries; ++i)
+  {
+    entry_t *e = &(node->entries[i]);
+
+    if(!e->mode || !node_wants(w, NODE_NAME(node, e), e->mode))
+      continue;
+
+    if(i != j)
+      node->entries[j] = *e;
+    ++j;
+  }
+
+  node->nentries = j;
+}
+
+#endif /* USE_URING */
+
+/* Add an entry to a node, unless it is filtered out. The mode is the
+ * entry's type if it is already known, and 0 if not. With a ring, entries
+ * that need to be stat'ed are added without a type, for ring_stat().
+ */
+
+static void node_entry(walker_t *w, node_t *node, int dfd, const char *name,
+                       mode_t mode, ring_t *ring)
+{
+  entry_t *e;
+
+  if(w->opts.exclude && matcher_match(w->opts.exclude, name))
+    return;
+
+  if(ring && (!mode || (w->opts.flags & WALK_STAT)))
+  {
+    node_add(node, name, 0);
+    return;
+  }
+
+  if(w->opts.flags & WALK_STAT)
+  {
+    entry_t tmp;
+
+    if(!(mode = entry_stat(dfd, name, &tmp)) || !node_wants(w, name, mode))
+      return;
+
+    e = node_add(node, name, mode);
+    tmp.name = e->name;
+    tmp.mode = mode;
+    tmp.dir = NULL;
+    *e = tmp;
+  }
+  else
+  {
+    if(!mode)
+      mode = entry_type(dfd, name);
+
+    if(!mode || !node_wants(w, name, mode))
+      return;
+
+    node_add(node, name, mode);
+  }
+}
+
+/* Read the entries of a node's directory, and create nodes for its
+ * subdirectories. In parallel mode, the new nodes are queued on the given
+ * deque. The ring, if any, is used to stat the entries.
+ */
+
+static void node_read(walker_t *w, node_t *node, void *deque, ring_t *ring)
+{
+  DIR *dp = NULL;
+  struct dirent *de;
+  entry_t *e;
+  mode_t mode;
+  size_t i, n, nsub = 0;
+  int fd = node_open(w, node);
+
+  if((fd >= 0) && (w->opts.flags & (WALK_XDEV | WALK_MTIME)))
+  {
+    struct stat st;
+    c_bool_t keep = (fstat(fd, &st) == 0);
+
+    if(keep)
+    {
+      /* the root is read before any of its subdirectories are queued */
+
+      if(!node->parent)
+        w->dev = st.st_dev;
+      else if((w->opts.flags & WALK_XDEV) && (st.st_dev != w->dev))
+        keep = FALSE;
+
+      node->mtime = st.st_mtime;
+      node->mtime_ns = MTIME_NSEC(st);
+    }
+
+    if(!keep)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  if(fd >= 0)
+  {
+    if(!(dp = fdopendir(fd)))
+      close(fd);
+  }
+
+#ifdef USE_URING
+  if(ring && !ring->ok)
+    ring = NULL;
+#else
+  ring = NULL;
+#endif
+
+  if(dp)
+  {
+    if((node->snap != SNAP_NONE) && snap_fresh(w->opts.snapshot, node->snap,
+                                               node->mtime, node->mtime_ns))
+    {
+      /* unchanged since the snapshot: take the names from there */
+
+      for(i = 0, n = snap_count(w->opts.snapshot, node->snap); i < n; ++i)
+      {
+        const char *name = snap_entry(w->opts.snapshot, node->snap, i,
+                                      &mode);
+
+        node_entry(w, node, dirfd(dp), name, mode, ring);
+      }
+    }
+    else
+    {
+      while((de = readdir(dp)))
+      {
+        if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+          continue;
+
+        /* the type usually comes free with the entry */
+
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+        mode = dtype_mode(de->d_type);
+#else
+        mode = 0;
+#endif
+
+        node_entry(w, node, dirfd(dp), de->d_name, mode, ring);
+      }
+    }
+
+#ifdef USE_URING
+    if(ring)
+    {
+      ring_stat(w, node, dirfd(dp), ring);
+      node_compact(w, node);
+    }
+#endif
+
+    if(w->opts.flags & WALK_SORT)
+      node_sort(node);
+
+    /* create nodes for the subdirectories, unless at the depth limit */
+
+    if(!w->opts.max_depth || (node->depth + 1 < w->opts.max_depth))
+    {
+      for(i = 0; i < node->nentries; ++i)
+      {
+        e = &(node->entries[i]);
+
+        if(!S_ISDIR(e->mode))
+          continue;
+
+        /* with WALK_STAT, mount points are known without opening them */
+
+        if((w->opts.flags & (WALK_STAT | WALK_XDEV))
+           == (WALK_STAT | WALK_XDEV) && (e->dev != (uint64_t)w->dev))
+          continue;
+
+        e->dir = node_create(node, NODE_NAME(node, e));
+        if(node->snap != SNAP_NONE)
+          e->dir->snap = snap_child(w->opts.snapshot, node->snap,
+                                    NODE_NAME(node, e));
+        ++nsub;
+      }
+    }
+
+    /* keep a descriptor for opening the subdirectories, if the budget
+     * allows
+     */
+
+    if(nsub > 0)
+    {
+      c_bool_t keep;
+
+      LOCK(w);
+      if((keep = (w->nfds < MAX_OPEN_DIRS)))
+        ++w->nfds;
+      UNLOCK(w);
+
+      node->refs = nsub;
+      if(keep && ((node->fd = dup(dirfd(dp))) < 0))
+      {
+        LOCK(w);
+        --w->nfds;
+        UNLOCK(w);
+      }
+    }
+
+    closedir(dp);
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  if(deque && (nsub > 0))
+  {
+    /* queue the subdirectories in reverse, so that the first is the next
+     * to be popped
+     */
+
+    for(i = node->nentries; i-- > 0;)
+    {
+      if(node->entries[i].dir)
+      {
+        node->entries[i].dir->queued = TRUE;
+        deque_push((deque_t *)deque, node->entries[i].dir);
+      }
+    }
+
+    pthread_mutex_lock(&(w->lock));
+    w->ntasks += nsub;
+    pthread_cond_broadcast(&(w->work));
+    pthread_mutex_unlock(&(w->lock));
+  }
+#endif
+
+  LOCK(w);
+  node->state = NODE_DONE;
+#ifdef HAVE_LIBPTHREAD
+  w->nread += node->nentries + 1;
+  if(w->waiting == node)
+    pthread_cond_signal(&(w->done));
+#endif
+  UNLOCK(w);
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ */
+
+static void *walk_worker(void *arg)
+{
+  worker_t *self = (worker_t *)arg;
+  walker_t *w = self->walker;
+  ring_t *ring = NULL;
+
+#ifdef USE_URING
+  if(w->opts.flags & WALK_URING)
+    ring = ring_create();
+#endif
+
+  for(;;)
+  {
+    node_t *node;
+    node_state_t state;
+    int i;
+
+    pthread_mutex_lock(&(w->lock));
+    while(((w->ntasks == 0) || (w->nread >= READ_AHEAD)) && !w->shutdown)
+      pthread_cond_wait(&(w->work), &(w->lock));
+
+    if(w->shutdown)
+    {
+      pthread_mutex_unlock(&(w->lock));
+      break;
+    }
+
+    --w->ntasks;
+    pthread_mutex_unlock(&(w->lock));
+
+    /* A node has been reserved, so one is sure to be found: first in our
+     * own deque, and otherwise in another's.
+     */
+
+    node = deque_take(&(w->deques[self->self]), TRUE);
+    for(i = 1; !node; ++i)
+      node = deque_take(&(w->deques[(self->self + i) % w->jobs]), FALSE);
+
+    /* The caller may have read it already, and even released it, in which
+     * case it is ours to free.
+     */
+
+    pthread_mutex_lock(&(w->lock));
+    node->queued = FALSE;
+    state = node->state;
+    if(state == NODE_PENDING)
+      node->state = NODE_READING;
+    pthread_mutex_unlock(&(w->lock));
+
+    if(state == NODE_PENDING)
+      node_read(w, node, &(w->deques[self->self]), ring);
+    else if(state == NODE_RELEASED)
+      C_free(node);
+  }
+
+#ifdef USE_URING
+  if(ring)
+    ring_destroy(ring);
+#endif
+
+  return(NULL);
+}
+
+#endif /* HAVE_LIBPTHREAD */
+
+/* Start walking the directory at path with the given options; if
+ * opts->jobs is 1, directories are read only as they are waited for.
+ */
+
+walker_t *walk_start(const char *path, const walkopts_t *opts)
+{
+  walker_t *w = C_new(walker_t);
+
+  w->path = path;
+  w->opts = *opts;
+  if(opts->snapshot)
+    w->opts.flags |= WALK_MTIME;
+  w->root = node_create(NULL, path);
+  w->root->snap = snap_root(opts->snapshot);
+
+#ifdef HAVE_LIBPTHREAD
+  w->jobs = opts->jobs;
+
+  if(w->jobs > 1)
+  {
+    int i, jobs = w->jobs;
+
+    pthread_mutex_init(&(w->lock), NULL);
+    pthread_cond_init(&(w->work), NULL);
+    pthread_cond_init(&(w->done), NULL);
+
+    w->deques = C_newa(jobs, deque_t);
+    for(i = 0; i < jobs; ++i)
+      pthread_mutex_init(&(w->deques[i].lock), NULL);
+
+    w->root->queued = TRUE;
+    deque_push(&(w->deques[0]), w->root);
+    w->ntasks = 1;
+
+    w->threads = C_newa(jobs, pthread_t);
+    w->workers = C_newa(jobs, worker_t);
+    for(i = 0; i < jobs; ++i)
+    {
+      w->workers[i].walker = w;
+      w->workers[i].self = i;
+      pthread_create(&(w->threads[i]), NULL, walk_worker, &(w->workers[i]));
+    }
+  }
+#endif
+
+#ifdef USE_URING
+  if((opts->flags & WALK_URING) && (opts->jobs <= 1))
+    w->ring = ring_create();
+#endif
+
+  return(w);
+}
+
+/*
+ */
+
+node_t *walk_root(walker_t *w)
+{
+  return(w->root);
+}
+
+/* Wait until a node's entries have been read.
+ */
+
+void walk_wait(walker_t *w, node_t *node)
+{
+#ifdef HAVE_LIBPTHREAD
+  if(w->threads)
+  {
+    c_bool_t claimed = FALSE;
+
+    pthread_mutex_lock(&(w->lock));
+    if(node->state == NODE_PENDING)
+    {
+      /* no worker has started on it; read it here rather than wait */
+
+      node->state = NODE_READING;
+      claimed = TRUE;
+    }
+    else
+    {
+      w->waiting = node;
+      while(node->state != NODE_DONE)
+        pthread_cond_wait(&(w->done), &(w->lock));
+      w->waiting = NULL;
+    }
+    pthread_mutex_unlock(&(w->lock));
+
+    if(claimed)
+      node_read(w, node, &(w->deques[0]), NULL);
+
+    return;
+  }
+#endif
+
+  if(node->state == NODE_PENDING)
+    node_read(w, node, NULL, w->ring);
+}
+
+/* Free a node once the caller is finished with it and all of its
+ * subdirectories.
+ */
+
+void walk_release(walker_t *w, node_t *node)
+{
+  size_t n = node->nentries + 1;
+
+  if(node->fd >= 0)
+  {
+    close(node->fd);
+    LOCK(w);
+    --w->nfds;
+    UNLOCK(w);
+  }
+
+  C_free(node->entries);
+  C_free(node->names);
+
+#ifdef HAVE_LIBPTHREAD
+  if(w->threads)
+  {
+    c_bool_t queued;
+
+    pthread_mutex_lock(&(w->lock));
+    if((w->nread >= READ_AHEAD) && (w->nread - n < READ_AHEAD))
+      pthread_cond_broadcast(&(w->work));
+    w->nread -= n;
+
+    /* a node that the caller read itself may still be on a deque; the
+     * worker that takes it will free it
+     */
+
+    if((queued = node->queued))
+      node->state = NODE_RELEASED;
+    pthread_mutex_unlock(&(w->lock));
+
+    if(queued)
+      return;
+  }
+#endif
+
+  C_free(node);
+}
+
+/* Stop the walk. Nodes that were not released are abandoned.
+ */
+
+void walk_finish(walker_t *w)
+{
+#ifdef HAVE_LIBPTHREAD
+  if(w->threads)
+  {
+    int i;
+
+    pthread_mutex_lock(&(w->lock));
+    w->shutdown = TRUE;
+    pthread_cond_broadcast(&(w->work));
+    pthread_mutex_unlock(&(w->lock));
+
+    for(i = 0; i < w->jobs; ++i)
+      pthread_join(w->threads[i], NULL);
+
+    for(i = 0; i < w->jobs; ++i)
+    {
+      deque_t *dq = &(w->deques[i]);
+      size_t j;
+
+      for(j = 0; j < dq->count; ++j)
+      {
+        node_t *node = dq->items[(dq->head + j) % dq->cap];
+
+        if(node->state == NODE_RELEASED)
+          C_free(node);
+      }
+
+      pthread_mutex_destroy(&(dq->lock));
+      C_free(dq->items);
+    }
+
+    pthread_cond_destroy(&(w->work));
+    pthread_cond_destroy(&(w->done));
+    pthread_mutex_destroy(&(w->lock));
+
+    C_free(w->threads);
+    C_free(w->workers);
+    C_free(w->deques);
+  }
+#endif
+
+#ifdef USE_URING
+  if(w->ring)
+    ring_destroy(w->ring);
+#endif
+
+  C_free(w);
+}
+
+/* end of source file */
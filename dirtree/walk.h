@@ -0,0 +1,110 @@
+/* ----------------------------------------------------------------------------
+   dirtree - print directory tree
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __DIRTREE_WALK_H
+#define __DIRTREE_WALK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "match.h"
+#include "snapshot.h"
+
+#define WALK_STAT 0x01    /* fill in the size and identity of entries */
+#define WALK_XDEV 0x02    /* don't descend into other filesystems */
+#define WALK_SORT 0x04    /* order entries by name */
+#define WALK_MTIME 0x08   /* record the modification times of directories */
+#define WALK_URING 0x10   /* stat entries in batches, where io_uring is
+                             available */
+
+/* A directory entry. Names are kept in the owning node's name buffer. */
+
+typedef struct
+{
+  size_t name;            /* offset of the name in the node's names */
+  mode_t mode;            /* file type bits only */
+  struct node_t *dir;     /* the subdirectory, for directories */
+
+  /* with WALK_STAT only: */
+
+  uint64_t size;          /* apparent size in bytes */
+  uint64_t blocks;        /* 512-byte blocks allocated */
+  uint64_t ino;
+  uint64_t dev;
+  uint32_t nlink;
+} entry_t;
+
+typedef enum { NODE_PENDING, NODE_READING, NODE_DONE, NODE_RELEASED }
+  node_state_t;
+
+/* A directory, and the entries read from it. */
+
+typedef struct node_t
+{
+  struct node_t *parent;
+  const char *name;       /* points into the parent's names */
+  uint_t depth;
+  node_state_t state;
+  c_bool_t queued;        /* still on a worker's deque */
+  int fd;                 /* kept open while subdirectories remain to be
+                             opened relative to it, or -1 */
+  uint_t refs;            /* subdirectories not yet opened */
+  time_t mtime;           /* with WALK_MTIME only */
+  long mtime_ns;
+  uint32_t snap;          /* the directory in the snapshot, or SNAP_NONE */
+  entry_t *entries;
+  size_t nentries;
+  size_t entcap;
+  char *names;
+  size_t namelen;
+  size_t namecap;
+} node_t;
+
+typedef struct walker_t walker_t;
+
+/* How to walk. Excluded names are neither listed nor, for directories,
+ * opened; if there are include patterns, files (but not directories) must
+ * match one of them to be listed. Directories found unchanged in the
+ * snapshot are not read; giving a snapshot implies WALK_MTIME.
+ */
+
+typedef struct
+{
+  int jobs;               /* worker threads; 1 to read on demand */
+  int flags;
+  uint_t max_depth;       /* levels of directories to read; 0 for all */
+  matcher_t *include;
+  matcher_t *exclude;
+  const snapshot_t *snapshot;  /* directories to reuse if unchanged */
+} walkopts_t;
+
+#define NODE_NAME(N, E) ((N)->names + (E)->name)
+
+extern walker_t *walk_start(const char *path, const walkopts_t *opts);
+extern node_t *walk_root(walker_t *w);
+extern void walk_wait(walker_t *w, node_t *node);
+extern void walk_release(walker_t *w, node_t *node);
+extern void walk_finish(walker_t *w);
+
+#endif /* __DIRTREE_WALK_H */
+
+/* end of header file */
@@ -27,7 +27,12 @@
 /* --- System Headers --- */
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <cbase/cbase.h>
 
@@ -37,14 +42,76 @@
 
 #define MAX_LINELEN 1024
 
+#define DFL_MEMLIMIT 64 /* megabytes */
+#define BLOCKSZ 65536
+#define MIN_BUCKETS 2
+#define MAX_BUCKETS 256
+#define DFL_BUCKETS 16
+#define STRATA_BUCKETS 64 /* initial size of stratum hash table */
+
 #define HEADER "ranline v" VERSION " - Mark Lindner"
-#define USAGE "[ -h ] [file]"
+#define USAGE "[ -h ] [ -s [ -m <megabytes> ] ] [ -n <count> ] " \
+  "[ -w <field> ] [ -k <field> ] [ -t <delim> ] [file]"
+
+/* --- Types --- */
+
+/* A block-oriented line scanner. Lines of any length are returned as
+ * pointers into the buffer, which grows as needed to hold the longest line.
+ */
+
+typedef struct
+{
+  FILE *fp;
+  char *buf;
+  size_t len;     /* bytes of valid data in buf */
+  size_t cap;     /* allocated size of buf */
+  size_t pos;     /* offset of first unconsumed byte */
+  c_bool_t eof;
+} scanner_t;
+
+/* A line held in a reservoir. Keys are kept in log space, i.e. ln(u)/w
+ * rather than u^(1/w), so that large weights don't underflow to zero.
+ */
+
+typedef struct
+{
+  double key;
+  unsigned long seq; /* input line number */
+  char *line;
+  size_t len;
+} sample_t;
+
+/* A weighted reservoir (A-ExpJ); one per stratum. Samples are kept in a
+ * min-heap on key, which grows on demand up to the sample size.
+ */
 
-/* --- File Scope Variables --- */
+typedef struct reservoir
+{
+  char *name;             /* stratum key, or NULL if not stratified */
+  size_t namelen;
+  unsigned long hash;
+  sample_t *heap;
+  size_t count;
+  size_t cap;
+  double skip;            /* weight remaining before next replacement */
+  struct reservoir *next; /* hash chain */
+} reservoir_t;
+
+/* Sampling parameters. */
+
+typedef struct
+{
+  size_t count;         /* lines per reservoir */
+  int weight_field;     /* 0 if unweighted */
+  int key_field;        /* 0 if not stratified */
+  int delim;            /* field delimiter, or 0 for whitespace */
+} sampling_t;
 
 /* --- Functions --- */
 
 static const char *ranline(FILE *, c_bool_t seek);
+static c_bool_t shuffle(FILE *fp, off_t size_hint, size_t memlimit);
+static c_bool_t sample(FILE *fp, const sampling_t *params);
 
 int main(int argc, char **argv)
 {
@@ -54,13 +121,16 @@ int main(int argc, char **argv)
   int c;
   c_bool_t errflag = FALSE;
   const char *line;
-  c_bool_t filter = FALSE;
+  c_bool_t filter = FALSE, shuf = FALSE, sampling = FALSE, ok = TRUE;
+  c_bool_t limited = FALSE;
+  long mem = DFL_MEMLIMIT, n;
+  sampling_t params = { 1, 0, 0, 0 };
 
   C_error_init(*argv);
 
   /* parse the command line */
 
-  while((c = getopt(argc, argv, "h")) != EOF)
+  while((c = getopt(argc, argv, "hsm:n:w:k:t:")) != EOF)
   {
     switch(c)
     {
@@ -70,12 +140,78 @@ int main(int argc, char **argv)
         exit(EXIT_SUCCESS);
         break;
 
+      case 's':
+        shuf = TRUE;
+        break;
+
+      case 'm':
+        limited = TRUE;
+        mem = atol(optarg);
+        if(mem < 1)
+        {
+          C_error_printf("Memory limit must be at least 1 megabyte\n");
+          errflag = TRUE;
+        }
+        break;
+
+      case 'n':
+        n = atol(optarg);
+        if(n < 1)
+        {
+          C_error_printf("Sample size must be at least 1\n");
+          errflag = TRUE;
+        }
+        else
+          params.count = (size_t)n;
+        sampling = TRUE;
+        break;
+
+      case 'w':
+        if((params.weight_field = atoi(optarg)) < 1)
+        {
+          C_error_printf("Invalid weight field number\n");
+          errflag = TRUE;
+        }
+        sampling = TRUE;
+        break;
+
+      case 'k':
+        if((params.key_field = atoi(optarg)) < 1)
+        {
+          C_error_printf("Invalid key field number\n");
+          errflag = TRUE;
+        }
+        sampling = TRUE;
+        break;
+
+      case 't':
+        if(strlen(optarg) != 1)
+        {
+          C_error_printf("Delimiter must be a single character\n");
+          errflag = TRUE;
+        }
+        else
+          params.delim = (unsigned char)*optarg;
+        break;
+
       default:
         errflag = TRUE;
         break;
     }
   }
 
+  if(limited && ! shuf)
+  {
+    C_error_printf("The memory limit applies only to shuffle mode\n");
+    errflag = TRUE;
+  }
+
+  if(shuf && sampling)
+  {
+    C_error_printf("Shuffle and sampling modes are mutually exclusive\n");
+    errflag = TRUE;
+  }
+
   /* catch illegal option errors */
 
   if(errflag)
@@ -97,17 +233,36 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  /* select a line and print it out */
-
   C_random_seed();
 
-  if((line = ranline(fp, !filter)) != NULL)
-    puts(line);
+  if(shuf)
+  {
+    /* shuffle the entire input */
+
+    ok = shuffle(fp, -1, (size_t)mem << 20);
+    if(fflush(stdout) != 0)
+      ok = FALSE;
+  }
+  else if(sampling)
+  {
+    /* draw a (weighted and/or stratified) sample of lines */
+
+    ok = sample(fp, &params);
+    if(fflush(stdout) != 0)
+      ok = FALSE;
+  }
+  else
+  {
+    /* select a line and print it out */
+
+    if((line = ranline(fp, !filter)) != NULL)
+      puts(line);
+  }
 
   if(filter)
     fclose(fp);
 
-  exit(EXIT_SUCCESS);
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 /*
@@ -169,4 +324,603 @@ static const char *ranline(FILE *fp, c_bool_t seek)
   return(buf);
 }
 
+/*
+ */
+
+static size_t ranbelow(size_t n)
+{
+  /* random() only yields 31 bits, so combine two draws so that inputs with
+   * more than 2^31 lines are still shuffled uniformly
+   */
+
+  unsigned long long r = ((unsigned long long)random() << 31) | random();
+
+  return((size_t)(r % n));
+}
+
+/*
+ */
+
+static void scanner_init(scanner_t *s, FILE *fp)
+{
+  s->fp = fp;
+  s->cap = BLOCKSZ;
+  s->buf = C_malloc(s->cap, char);
+  s->len = s->pos = 0;
+  s->eof = FALSE;
+}
+
+/*
+ */
+
+static void scanner_free(scanner_t *s)
+{
+  C_free(s->buf);
+}
+
+/*
+ */
+
+static c_bool_t scanner_read(scanner_t *s)
+{
+  size_t n;
+
+  if(s->cap - s->len < BLOCKSZ)
+  {
+    s->cap *= 2;
+    s->buf = C_realloc(s->buf, s->cap, char);
+  }
+
+  n = fread(s->buf + s->len, 1, s->cap - s->len, s->fp);
+  if(n == 0)
+    s->eof = TRUE;
+
+  s->len += n;
+  return(n > 0);
+}
+
+/* Return the next line (including its newline, if it has one), or FALSE at
+ * end of input.
+ */
+
+static c_bool_t scanner_next(scanner_t *s, const char **line, size_t *len)
+{
+  for(;;)
+  {
+    const char *nl = memchr(s->buf + s->pos, '\n', s->len - s->pos);
+
+    if(nl)
+    {
+      *line = s->buf + s->pos;
+      *len = nl - *line + 1;
+      s->pos += *len;
+      return(TRUE);
+    }
+
+    if(s->eof)
+    {
+      if(s->pos == s->len)
+        return(FALSE);
+
+      /* last line is missing its newline */
+
+      *line = s->buf + s->pos;
+      *len = s->len - s->pos;
+      s->pos = s->len;
+      return(TRUE);
+    }
+
+    /* slide the partial line to the front and read more */
+
+    if(s->pos > 0)
+    {
+      memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+      s->len -= s->pos;
+      s->pos = 0;
+    }
+
+    scanner_read(s);
+  }
+}
+
+/*
+ */
+
+static c_bool_t write_line(FILE *fp, const char *line, size_t len)
+{
+  if(fwrite(line, 1, len, fp) != len)
+    return(FALSE);
+
+  if(line[len - 1] != '\n')
+    return(putc('\n', fp) != EOF);
+
+  return(TRUE);
+}
+
+/* Shuffle all lines of fp to stdout. If the input fits within memlimit
+ * bytes (text plus line index), it is shuffled in memory with Fisher-Yates.
+ * Otherwise each line is scattered into a randomly chosen temporary bucket
+ * file, and each bucket is then shuffled in turn (recursively, should a
+ * bucket itself turn out to be too large). Concatenating uniformly shuffled
+ * buckets whose members were assigned uniformly at random yields a uniform
+ * permutation of the whole input.
+ */
+
+static c_bool_t shuffle(FILE *fp, off_t size_hint, size_t memlimit)
+{
+  scanner_t s;
+  size_t *offs, noffs = 0, offcap = 1024, scanned = 0, next, i;
+  c_bool_t ok = TRUE, full = FALSE;
+
+  scanner_init(&s, fp);
+  offs = C_malloc(offcap, size_t);
+
+  /* pass 1: index as much of the input as fits; the limit applies to the
+   * buffer and index as they will be after they grow
+   */
+
+  while(! full)
+  {
+    char *nl;
+
+    next = ((s.cap - s.len < BLOCKSZ) ? s.cap * 2 : s.cap);
+    if((next + (offcap * sizeof(size_t)) > memlimit) && (noffs >= 2))
+      break;
+
+    if(!scanner_read(&s))
+      break;
+
+    while((nl = memchr(s.buf + scanned, '\n', s.len - scanned)) != NULL)
+    {
+      if(noffs == offcap)
+      {
+        if((s.cap + (offcap * 2 * sizeof(size_t)) > memlimit)
+           && (noffs >= 2))
+        {
+          full = TRUE;
+          break;
+        }
+
+        offcap *= 2;
+        offs = C_realloc(offs, offcap, size_t);
+      }
+      offs[noffs++] = scanned;
+      scanned = nl - s.buf + 1;
+    }
+  }
+
+  if(s.eof && ! full)
+  {
+    /* the whole input is in memory */
+
+    if(scanned < s.len)
+    {
+      if(noffs == offcap)
+        offs = C_realloc(offs, ++offcap, size_t);
+      offs[noffs++] = scanned;
+    }
+
+    for(i = noffs; i > 1; --i)
+    {
+      size_t j = ranbelow(i), t = offs[i - 1];
+
+      offs[i - 1] = offs[j];
+      offs[j] = t;
+    }
+
+    for(i = 0; ok && (i < noffs); ++i)
+    {
+      size_t start = offs[i];
+      const char *nl = memchr(s.buf + start, '\n', s.len - start);
+      size_t end = (nl ? (size_t)(nl - s.buf + 1) : s.len);
+
+      ok = write_line(stdout, s.buf + start, end - start);
+    }
+  }
+  else
+  {
+    /* pass 2: too big; scatter lines into buckets */
+
+    FILE *buckets[MAX_BUCKETS];
+    off_t sizes[MAX_BUCKETS];
+    struct stat st;
+    int nb = DFL_BUCKETS, b;
+    const char *line;
+    size_t len;
+
+    if(size_hint < 0 && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+      size_hint = st.st_size;
+
+    if(size_hint > 0)
+    {
+      /* aim for buckets about half the memory limit */
+
+      off_t n = (size_hint / (off_t)(memlimit / 2 + 1)) + 1;
+      nb = (int)((n > MAX_BUCKETS) ? MAX_BUCKETS : n);
+      if(nb < MIN_BUCKETS)
+        nb = MIN_BUCKETS;
+    }
+
+    for(b = 0; b < nb; ++b)
+    {
+      sizes[b] = 0;
+      if(!(buckets[b] = tmpfile()))
+      {
+        C_error_syserr();
+        while(b--)
+          fclose(buckets[b]);
+        C_free(offs);
+        scanner_free(&s);
+        return(FALSE);
+      }
+    }
+
+    /* the index is no longer needed; hand the buffered text back to the
+     * scanner and stream everything through it
+     */
+
+    C_free(offs);
+    offs = NULL;
+
+    while(ok && scanner_next(&s, &line, &len))
+    {
+      b = (int)ranbelow(nb);
+      sizes[b] += len;
+      ok = write_line(buckets[b], line, len);
+    }
+
+    scanner_free(&s);
+    s.buf = NULL;
+
+    if(!ok)
+      C_error_syserr();
+
+    for(b = 0; b < nb; ++b)
+    {
+      if(ok && sizes[b] > 0)
+      {
+        rewind(buckets[b]);
+        ok = shuffle(buckets[b], sizes[b], memlimit);
+      }
+      fclose(buckets[b]);
+    }
+  }
+
+  C_free(offs);
+  if(s.buf)
+    scanner_free(&s);
+
+  return(ok);
+}
+
+/* Return a uniform random number in the open interval (0, 1).
+ */
+
+static double ranunit(void)
+{
+  return((random() + 0.5) / 2147483648.0);
+}
+
+/* Locate field number n (1-based) of line. With no delimiter, fields are
+ * separated by runs of whitespace.
+ */
+
+static const char *get_field(const char *line, size_t len, int n, int delim,
+                             size_t *flen)
+{
+  const char *p = line, *end = line + len, *q;
+
+  if(len > 0 && line[len - 1] == '\n')
+    --end;
+
+  if(delim)
+  {
+    while(--n > 0)
+    {
+      if(!(q = memchr(p, delim, end - p)))
+        return(NULL);
+      p = q + 1;
+    }
+
+    q = memchr(p, delim, end - p);
+    *flen = (q ? q : end) - p;
+  }
+  else
+  {
+    for(;;)
+    {
+      while(p < end && isspace((unsigned char)*p))
+        ++p;
+      if(p == end)
+        return(NULL);
+      if(--n == 0)
+        break;
+      while(p < end && !isspace((unsigned char)*p))
+        ++p;
+    }
+
+    for(q = p; q < end && !isspace((unsigned char)*q); ++q);
+    *flen = q - p;
+  }
+
+  return(p);
+}
+
+/*
+ */
+
+static void heap_sift_down(sample_t *heap, size_t count, size_t i)
+{
+  sample_t t = heap[i];
+
+  for(;;)
+  {
+    size_t c = (2 * i) + 1;
+
+    if(c >= count)
+      break;
+    if((c + 1 < count) && (heap[c + 1].key < heap[c].key))
+      ++c;
+    if(t.key <= heap[c].key)
+      break;
+
+    heap[i] = heap[c];
+    i = c;
+  }
+
+  heap[i] = t;
+}
+
+/*
+ */
+
+static void heap_sift_up(sample_t *heap, size_t i)
+{
+  sample_t t = heap[i];
+
+  while(i > 0)
+  {
+    size_t p = (i - 1) / 2;
+
+    if(heap[p].key <= t.key)
+      break;
+
+    heap[i] = heap[p];
+    i = p;
+  }
+
+  heap[i] = t;
+}
+
+/* Offer a line of weight w to a reservoir of capacity k, using Efraimidis
+ * and Spirakis' A-ExpJ: once the reservoir is full, a random amount of
+ * weight to skip is drawn from the current minimum key, so random numbers
+ * are only generated for lines that actually enter the reservoir.
+ */
+
+static void reservoir_offer(reservoir_t *r, size_t k, double w,
+                            unsigned long seq, const char *line, size_t len)
+{
+  sample_t *s;
+
+  if(r->count < k)
+  {
+    if(r->count == r->cap)
+    {
+      r->cap = (r->cap ? r->cap * 2 : 4);
+      if(r->cap > k)
+        r->cap = k;
+      r->heap = C_realloc(r->heap, r->cap, sample_t);
+    }
+
+    s = &(r->heap[r->count]);
+    s->key = log(ranunit()) / w;
+    s->seq = seq;
+    s->line = C_malloc(len, char);
+    memcpy(s->line, line, len);
+    s->len = len;
+    heap_sift_up(r->heap, r->count++);
+
+    if(r->count == k)
+      r->skip = log(ranunit()) / r->heap[0].key;
+  }
+  else
+  {
+    double tw;
+
+    if((r->skip -= w) > 0)
+      return;
+
+    /* this line replaces the minimum, with a key drawn from (t_w, 1) */
+
+    tw = exp(w * r->heap[0].key);
+    s = &(r->heap[0]);
+    s->key = log(tw + (ranunit() * (1.0 - tw))) / w;
+    s->seq = seq;
+    s->line = C_realloc(s->line, len, char);
+    memcpy(s->line, line, len);
+    s->len = len;
+    heap_sift_down(r->heap, r->count, 0);
+
+    r->skip = log(ranunit()) / r->heap[0].key;
+  }
+}
+
+/*
+ */
+
+static unsigned long hash_key(const char *key, size_t len)
+{
+  unsigned long h = 2166136261UL; /* FNV-1a */
+
+  while(len--)
+    h = (h ^ (unsigned char)*key++) * 16777619UL;
+
+  return(h);
+}
+
+/*
+ */
+
+static int compare_seq(const void *a, const void *b)
+{
+  unsigned long sa = (*(const sample_t **)a)->seq;
+  unsigned long sb = (*(const sample_t **)b)->seq;
+
+  return((sa > sb) - (sa < sb));
+}
+
+/* Sample lines from fp in a single pass, with probability proportional to
+ * a weight field, and/or with a separate reservoir for each distinct value
+ * of a key field. Memory use is bounded by the sample size times the number
+ * of distinct keys. The selected lines are written in input order.
+ */
+
+static c_bool_t sample(FILE *fp, const sampling_t *params)
+{
+  scanner_t s;
+  reservoir_t **table, *r, *next;
+  reservoir_t single;
+  size_t nbuckets = STRATA_BUCKETS, nstrata = 0, total = 0, i, j;
+  unsigned long seq = 0;
+  const char *line, *f;
+  size_t len, flen;
+  sample_t **out;
+  c_bool_t ok = TRUE;
+
+  memset(&single, 0, sizeof(single));
+  table = C_newa(nbuckets, reservoir_t *);
+  scanner_init(&s, fp);
+
+  while(scanner_next(&s, &line, &len))
+  {
+    double w = 1.0;
+
+    ++seq;
+
+    if(params->weight_field)
+    {
+      char *e;
+
+      /* lines with a missing, malformed or non-positive weight can never be
+       * selected
+       */
+
+      if(!(f = get_field(line, len, params->weight_field, params->delim,
+                         &flen)))
+        continue;
+
+      w = strtod(f, &e);
+      if((e == f) || !(w > 0.0) || isinf(w))
+        continue;
+    }
+
+    if(params->key_field)
+    {
+      unsigned long h;
+      reservoir_t **rp;
+
+      if(!(f = get_field(line, len, params->key_field, params->delim, &flen)))
+        f = "", flen = 0;
+
+      h = hash_key(f, flen);
+      for(r = table[h & (nbuckets - 1)]; r; r = r->next)
+      {
+        if((r->hash == h) && (r->namelen == flen)
+           && !memcmp(r->name, f, flen))
+          break;
+      }
+
+      if(!r)
+      {
+        if(++nstrata > nbuckets)
+        {
+          /* rehash into a table twice the size */
+
+          reservoir_t **nt = C_newa(nbuckets * 2, reservoir_t *);
+
+          for(i = 0; i < nbuckets; ++i)
+          {
+            for(r = table[i]; r; r = next)
+            {
+              next = r->next;
+              rp = &(nt[r->hash & ((nbuckets * 2) - 1)]);
+              r->next = *rp;
+              *rp = r;
+            }
+          }
+
+          C_free(table);
+          table = nt;
+          nbuckets *= 2;
+        }
+
+        r = C_new(reservoir_t);
+        r->name = C_malloc(flen + 1, char);
+        memcpy(r->name, f, flen);
+        r->namelen = flen;
+        r->hash = h;
+        rp = &(table[h & (nbuckets - 1)]);
+        r->next = *rp;
+        *rp = r;
+      }
+    }
+    else
+      r = &single;
+
+    reservoir_offer(r, params->count, w, seq, line, len);
+  }
+
+  if(ferror(fp))
+  {
+    C_error_syserr();
+    ok = FALSE;
+  }
+
+  scanner_free(&s);
+
+  /* gather up the selected lines and write them out in input order */
+
+  if(!params->key_field)
+    table[0] = &single;
+
+  for(i = 0; i < nbuckets; ++i)
+    for(r = table[i]; r; r = r->next)
+      total += r->count;
+
+  out = C_newa(total + 1, sample_t *);
+
+  for(i = 0, total = 0; i < nbuckets; ++i)
+    for(r = table[i]; r; r = r->next)
+      for(j = 0; j < r->count; ++j)
+        out[total++] = &(r->heap[j]);
+
+  qsort(out, total, sizeof(sample_t *), compare_seq);
+
+  for(i = 0; ok && (i < total); ++i)
+    ok = write_line(stdout, out[i]->line, out[i]->len);
+
+  C_free(out);
+
+  for(i = 0; i < nbuckets; ++i)
+  {
+    for(r = table[i]; r; r = next)
+    {
+      next = r->next;
+      for(j = 0; j < r->count; ++j)
+        C_free(r->heap[j].line);
+      C_free(r->heap);
+      if(r != &single)
+      {
+        C_free(r->name);
+        C_free(r);
+      }
+    }
+  }
+
+  C_free(table);
+
+  return(ok);
+}
+
 /* end of source file */
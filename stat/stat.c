@@ -49,6 +49,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_STATX
+#include <fcntl.h>
+#endif
 
 #include <cbase/cbase.h>
 
@@ -57,12 +64,215 @@
 /* --- Macros --- */
 
 #define HEADER "stat v" VERSION " - Mark Lindner"
-#define USAGE "[ -h ] <file> [ <file> ... ]"
+#define USAGE "[ -eh ] [ -c <format> ] [ -j <jobs> ] <file> [ <file> ... ]"
 
 #define LINKBUFSZ 256 /* symlink buffer size */
 
 #define SINCE
 
+#define INITIAL_IDS 64 /* initial size of the user and group name caches */
+#define INITIAL_OPS 16
+#define OUTBUFSZ 65536 /* output is written in chunks of about this size */
+
+#define MAX_JOBS 256
+#define BATCH 16      /* files claimed by a thread at once */
+#define AHEAD 4096    /* files that may be examined ahead of the output */
+
+#ifndef STATX_TYPE
+/* Without statx(), these bits record which fields lstat() has filled in. */
+#define STATX_TYPE        0x0001U
+#define STATX_MODE        0x0002U
+#define STATX_NLINK       0x0004U
+#define STATX_UID         0x0008U
+#define STATX_GID         0x0010U
+#define STATX_ATIME       0x0020U
+#define STATX_MTIME       0x0040U
+#define STATX_CTIME       0x0080U
+#define STATX_INO         0x0100U
+#define STATX_SIZE        0x0200U
+#define STATX_BLOCKS      0x0400U
+#define STATX_BASIC_STATS 0x07ffU
+#define STATX_BTIME       0x0800U
+#endif /* STATX_TYPE */
+
+#ifdef STATX_MNT_ID
+#define WANT_MNT_ID STATX_MNT_ID
+#else
+#define WANT_MNT_ID 0
+#endif
+
+/* the fields that the standard output needs */
+
+#define DEFAULT_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID   \
+                      | STATX_GID | STATX_ATIME | STATX_MTIME             \
+                      | STATX_CTIME | STATX_INO | STATX_SIZE)
+
+/* --- Types --- */
+
+/* A cache of user or group names, keyed by ID, so that each ID is looked up
+ * only once however many files are examined.
+ */
+
+typedef struct
+{
+  unsigned long id;
+  char *name;         /* NULL marks a free slot */
+} idname_t;
+
+typedef struct
+{
+  idname_t *slots;
+  size_t size;        /* a power of two, or 0 */
+  size_t count;
+} idcache_t;
+
+/* The information about a file, from statx() where it is available, so
+ * that only the fields that are wanted need be fetched, or else from
+ * lstat(). The device numbers are always filled in.
+ */
+
+typedef struct
+{
+  unsigned int have;  /* STATX_* bits for the fields that are valid */
+  mode_t mode;
+  nlink_t nlink;
+  uid_t uid;
+  gid_t gid;
+  ino_t ino;
+  off_t size;
+  blkcnt_t blocks;
+  time_t atime;
+  time_t mtime;
+  time_t ctime;
+  time_t btime;
+  unsigned long dev_major, dev_minor;
+  unsigned long rdev_major, rdev_minor;
+  unsigned long long mnt_id;
+  unsigned long long attrs;
+  unsigned long long attrs_mask; /* attributes the filesystem supports */
+} info_t;
+
+/* The operations that a -c format is compiled into. */
+
+typedef enum
+{
+  OP_TEXT, OP_NAME, OP_QNAME, OP_SIZE, OP_BLOCKS, OP_RAWMODE, OP_OCTMODE,
+  OP_MODE, OP_TYPE, OP_LINKS, OP_UID, OP_USER, OP_GID, OP_GROUP, OP_INODE,
+  OP_DEV, OP_RDEV, OP_MOUNT, OP_ATIME, OP_MTIME, OP_CTIME, OP_BTIME,
+  OP_ATIME_SEC, OP_MTIME_SEC, OP_CTIME_SEC, OP_BTIME_SEC
+} opcode_t;
+
+typedef struct
+{
+  opcode_t code;
+  const char *text;   /* for OP_TEXT; not terminated */
+  size_t len;
+} fmtop_t;
+
+#ifdef HAVE_LIBPTHREAD
+
+/* The files being examined by a pool of threads. File i's result is kept
+ * in slot i % AHEAD until it has been printed.
+ */
+
+typedef struct
+{
+  info_t info;
+  c_bool_t ok;
+  c_bool_t done;
+} result_t;
+
+typedef struct
+{
+  char **files;
+  size_t count;
+  size_t next;          /* the next file to be claimed */
+  size_t printed;       /* the number of files printed so far */
+  result_t *results;
+  pthread_mutex_t lock;
+  pthread_cond_t ready; /* signalled when a result is done */
+  pthread_cond_t room;  /* signalled when a slot is freed */
+} pool_t;
+
+#endif /* HAVE_LIBPTHREAD */
+
+/* --- File Scope Variables --- */
+
+static idcache_t users, groups;
+
+static unsigned int want = DEFAULT_MASK;
+static c_bool_t extended = FALSE;
+static const char *format = NULL;
+
+static fmtop_t *ops = NULL;
+static size_t nops = 0;
+
+static char *obuf = NULL;
+static size_t olen = 0, ocap = 0;
+
+/* The conversions in a -c format, and the fields that each of them needs. */
+
+static const struct
+{
+  char conv;
+  opcode_t code;
+  unsigned int mask;
+} conversions[] = {
+  { 'n', OP_NAME, 0 },
+  { 'N', OP_QNAME, STATX_TYPE },
+  { 's', OP_SIZE, STATX_SIZE },
+  { 'b', OP_BLOCKS, STATX_BLOCKS },
+  { 'f', OP_RAWMODE, STATX_TYPE | STATX_MODE },
+  { 'a', OP_OCTMODE, STATX_MODE },
+  { 'A', OP_MODE, STATX_TYPE | STATX_MODE },
+  { 'F', OP_TYPE, STATX_TYPE },
+  { 'h', OP_LINKS, STATX_NLINK },
+  { 'u', OP_UID, STATX_UID },
+  { 'U', OP_USER, STATX_UID },
+  { 'g', OP_GID, STATX_GID },
+  { 'G', OP_GROUP, STATX_GID },
+  { 'i', OP_INODE, STATX_INO },
+  { 'd', OP_DEV, 0 },
+  { 'r', OP_RDEV, 0 },
+  { 'm', OP_MOUNT, WANT_MNT_ID },
+  { 'x', OP_ATIME, STATX_ATIME },
+  { 'y', OP_MTIME, STATX_MTIME },
+  { 'z', OP_CTIME, STATX_CTIME },
+  { 'w', OP_BTIME, STATX_BTIME },
+  { 'X', OP_ATIME_SEC, STATX_ATIME },
+  { 'Y', OP_MTIME_SEC, STATX_MTIME },
+  { 'Z', OP_CTIME_SEC, STATX_CTIME },
+  { 'W', OP_BTIME_SEC, STATX_BTIME },
+  { '\0', OP_TEXT, 0 }
+};
+
+#ifdef HAVE_STATX
+
+static const struct
+{
+  unsigned long long attr;
+  const char *name;
+} attr_names[] = {
+  { STATX_ATTR_COMPRESSED, "compressed" },
+  { STATX_ATTR_IMMUTABLE, "immutable" },
+  { STATX_ATTR_APPEND, "append" },
+  { STATX_ATTR_NODUMP, "nodump" },
+  { STATX_ATTR_ENCRYPTED, "encrypted" },
+  { STATX_ATTR_AUTOMOUNT, "automount" },
+#ifdef STATX_ATTR_MOUNT_ROOT
+  { STATX_ATTR_MOUNT_ROOT, "mount-root" },
+#endif
+#ifdef STATX_ATTR_VERITY
+  { STATX_ATTR_VERITY, "verity" },
+#endif
+#ifdef STATX_ATTR_DAX
+  { STATX_ATTR_DAX, "dax" },
+#endif
+  { 0, NULL }
+};
+
+#endif /* HAVE_STATX */
+
 /* --- Functions --- */
 
 #ifdef SINCE
@@ -99,27 +309,728 @@ static void tsince(long time_sec)
 /*
  */
 
-static void dostat(const char *filename);
+static idname_t *idcache_slot(idcache_t *cache, unsigned long id)
+{
+  size_t i;
+
+  for(i = (id * 2654435761UL) & (cache->size - 1);
+      cache->slots[i].name && (cache->slots[i].id != id);
+      i = (i + 1) & (cache->size - 1))
+    ;
+
+  return(&(cache->slots[i]));
+}
+
+/* Look up the name for a user or group ID, consulting the system only the
+ * first time each ID is seen. Unknown IDs are named "?".
+ */
+
+static const char *idcache_name(idcache_t *cache, unsigned long id,
+                                c_bool_t group)
+{
+  idname_t *slot;
+  const char *name = NULL;
+
+  if((cache->count + 1) * 2 > cache->size)
+  {
+    idname_t *old = cache->slots;
+    size_t i, oldsize = cache->size;
+
+    cache->size = (cache->size ? cache->size * 2 : INITIAL_IDS);
+    cache->slots = C_newa(cache->size, idname_t);
+
+    for(i = 0; i < oldsize; ++i)
+    {
+      if(old[i].name)
+        *idcache_slot(cache, old[i].id) = old[i];
+    }
+
+    C_free(old);
+  }
+
+  slot = idcache_slot(cache, id);
+  if(slot->name)
+    return(slot->name);
+
+  if(group)
+  {
+    struct group *grent = getgrgid((gid_t)id);
+
+    if(grent)
+      name = grent->gr_name;
+  }
+  else
+  {
+    struct passwd *pwent = getpwuid((uid_t)id);
+
+    if(pwent)
+      name = pwent->pw_name;
+  }
+
+  slot->id = id;
+  slot->name = C_string_dup(name ? name : "?");
+  ++cache->count;
+
+  return(slot->name);
+}
+
+/* Examine a file, without following it if it is a symbolic link, asking
+ * for the fields in mask. Other fields may be filled in as well; the have
+ * member tells which are valid. Returns FALSE if the file can't be
+ * examined.
+ */
+
+static c_bool_t getinfo(const char *filename, unsigned int mask,
+                        info_t *info)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if(statx(AT_FDCWD, filename, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask,
+           &stx) != 0)
+    return(FALSE);
+
+  info->have = stx.stx_mask;
+  info->mode = stx.stx_mode;
+  info->nlink = stx.stx_nlink;
+  info->uid = stx.stx_uid;
+  info->gid = stx.stx_gid;
+  info->ino = stx.stx_ino;
+  info->size = stx.stx_size;
+  info->blocks = stx.stx_blocks;
+  info->atime = stx.stx_atime.tv_sec;
+  info->mtime = stx.stx_mtime.tv_sec;
+  info->ctime = stx.stx_ctime.tv_sec;
+  info->btime = stx.stx_btime.tv_sec;
+  info->dev_major = stx.stx_dev_major;
+  info->dev_minor = stx.stx_dev_minor;
+  info->rdev_major = stx.stx_rdev_major;
+  info->rdev_minor = stx.stx_rdev_minor;
+#ifdef STATX_MNT_ID
+  info->mnt_id = stx.stx_mnt_id;
+#else
+  info->mnt_id = 0;
+#endif
+  info->attrs = stx.stx_attributes;
+  info->attrs_mask = stx.stx_attributes_mask;
+#else
+  struct stat st;
+
+  if(lstat(filename, &st) != 0)
+    return(FALSE);
+
+  info->have = STATX_BASIC_STATS;
+  info->mode = st.st_mode;
+  info->nlink = st.st_nlink;
+  info->uid = st.st_uid;
+  info->gid = st.st_gid;
+  info->ino = st.st_ino;
+  info->size = st.st_size;
+  info->blocks = st.st_blocks;
+  info->atime = st.st_atime;
+  info->mtime = st.st_mtime;
+  info->ctime = st.st_ctime;
+  info->btime = 0;
+  info->dev_major = major(st.st_dev);
+  info->dev_minor = minor(st.st_dev);
+  info->rdev_major = major(st.st_rdev);
+  info->rdev_minor = minor(st.st_rdev);
+  info->mnt_id = 0;
+  info->attrs = 0;
+  info->attrs_mask = 0;
+#endif
+
+  return(TRUE);
+}
+
+/*
+ */
+
+static void put_attrs(const info_t *info)
+{
+#ifdef HAVE_STATX
+  int i;
+  c_bool_t first = TRUE;
+
+  if(info->attrs_mask != 0)
+  {
+    for(i = 0; attr_names[i].name; ++i)
+    {
+      if(info->attrs & attr_names[i].attr)
+      {
+        printf("%s%s", first ? "" : ",", attr_names[i].name);
+        first = FALSE;
+      }
+    }
+
+    if(first)
+      printf("none");
+
+    putchar('\n');
+    return;
+  }
+#endif
+
+  printf("-\n");
+}
+
+/* Describe the type of a file.
+ */
+
+static const char *type_name(mode_t mode)
+{
+  switch(mode & S_IFMT)
+  {
+    case S_IFDIR:
+      return("Directory");
+    case S_IFCHR:
+      return("Character Device");
+    case S_IFBLK:
+      return("Block Device");
+    case S_IFREG:
+      return("Regular File");
+    case S_IFLNK:
+      return("Symbolic Link");
+    case S_IFSOCK:
+      return("Socket");
+#ifdef S_IFDOOR
+    case S_IFDOOR:
+      return("Door");
+#endif
+    case S_IFIFO:
+      return("Fifo (Named Pipe)");
+    default:
+      return("Unknown");
+  }
+}
+
+/* Format the type and permissions of a file in the style of ls -l, into a
+ * buffer of at least 11 characters.
+ */
+
+static void mode_string(mode_t mode, char *buf)
+{
+  strcpy(buf, "----------");
+
+  if(mode & (S_IEXEC >> 6)) /* Other execute */
+    buf[9] = 'x';
+  if(mode & (S_IWRITE >> 6)) /* Other write */
+    buf[8] = 'w';
+  if(mode & (S_IREAD >> 6)) /* Other read */
+    buf[7] = 'r';
+  if(mode & (S_IEXEC >> 3)) /* Group execute */
+    buf[6] = 'x';
+  if(mode & (S_IWRITE >> 3)) /* Group write */
+    buf[5] = 'w';
+  if(mode & (S_IREAD >> 3)) /* Group read */
+    buf[4] = 'r';
+  if(mode & S_IEXEC) /* User execute */
+    buf[3] = 'x';
+  if(mode & S_IWRITE) /* User write */
+    buf[2] = 'w';
+  if(mode & S_IREAD) /* User read */
+    buf[1] = 'r';
+  if(mode & S_ISVTX) /* Sticky bit */
+    buf[9] = 't';
+  if(mode & S_ISGID) /* Set group id */
+    buf[6] = 's';
+  if(mode & S_ISUID) /* Set user id */
+    buf[3] = 's';
+
+  switch(mode & S_IFMT)
+  {
+    case S_IFDIR:
+      buf[0] = 'd';
+      break;
+
+    case S_IFCHR:
+      buf[0] = 'c';
+      break;
+
+    case S_IFBLK:
+      buf[0] = 'b';
+      break;
+
+    case S_IFREG:
+      buf[0] = '-';
+      break;
+
+    case S_IFLNK:
+      buf[0] = 'l';
+      break;
+
+    case S_IFSOCK:
+      buf[0] = 's';
+      break;
+
+    case S_IFIFO:
+      buf[0] = 'p';
+      break;
+
+#ifdef S_IFDOOR
+    case S_IFDOOR:
+      buf[0] = 'D';
+      break;
+#endif
+
+    default:
+      buf[0] = '?';
+  }
+}
+
+/* Compile a -c format into an array of operations, and work out which
+ * fields it needs. The text operations point into the format itself.
+ * Returns FALSE if the format is invalid.
+ */
+
+static c_bool_t compile_format(const char *fmt)
+{
+  const char *p, *q;
+  size_t cap = 0;
+  int i;
+  fmtop_t *op;
+
+  want = 0;
+
+  for(p = fmt; *p; p = q)
+  {
+    if(nops == cap)
+    {
+      cap = (cap ? cap * 2 : INITIAL_OPS);
+      ops = C_realloc(ops, cap, fmtop_t);
+    }
+
+    op = &(ops[nops++]);
+
+    if(*p != '%')
+    {
+      for(q = p; *q && (*q != '%'); ++q)
+        ;
+
+      op->code = OP_TEXT;
+      op->text = p;
+      op->len = q - p;
+    }
+    else if(*(p + 1) == '%')
+    {
+      op->code = OP_TEXT;
+      op->text = p;
+      op->len = 1;
+      q = p + 2;
+    }
+    else
+    {
+      for(i = 0; conversions[i].conv && (conversions[i].conv != *(p + 1));
+          ++i)
+        ;
+
+      if(! conversions[i].conv)
+      {
+        if(*(p + 1))
+          C_error_printf("Unknown conversion %%%c in format\n", *(p + 1));
+        else
+          C_error_printf("Incomplete conversion at end of format\n");
+
+        return(FALSE);
+      }
+
+      op->code = conversions[i].code;
+      want |= conversions[i].mask;
+      q = p + 2;
+    }
+  }
+
+  return(TRUE);
+}
+
+/*
+ */
+
+static void out_flush(void)
+{
+  fwrite(obuf, 1, olen, stdout);
+  olen = 0;
+}
+
+/*
+ */
+
+static void out_put(const char *s, size_t len)
+{
+  if(olen + len > ocap)
+  {
+    do
+      ocap = (ocap ? ocap * 2 : OUTBUFSZ);
+    while(olen + len > ocap);
+
+    obuf = C_realloc(obuf, ocap, char);
+  }
+
+  memcpy(obuf + olen, s, len);
+  olen += len;
+}
+
+/*
+ */
+
+static void out_str(const char *s)
+{
+  out_put(s, strlen(s));
+}
+
+/*
+ */
+
+static void out_num(unsigned long long v, uint_t base)
+{
+  char buf[24], *p = buf + sizeof(buf);
+
+  do
+    *--p = "0123456789abcdef"[v % base];
+  while(v /= base);
+
+  out_put(p, (buf + sizeof(buf)) - p);
+}
+
+/*
+ */
+
+static void out_signed(long long v)
+{
+  if(v < 0)
+  {
+    out_put("-", 1);
+    out_num(-(unsigned long long)v, 10);
+  }
+  else
+    out_num(v, 10);
+}
+
+/* Write a time in the same form as the standard output.
+ */
+
+static void out_time(time_t t)
+{
+  const char *s = ctime(&t);
+
+  if(s)
+    out_put(s, 24);
+  else
+    out_put("?", 1);
+}
+
+/* Write a line for a file according to the compiled format.
+ */
+
+static void format_file(const char *filename, const info_t *info)
+{
+  const fmtop_t *op;
+  char buf[LINKBUFSZ];
+  int count;
+
+  for(op = ops; op < ops + nops; ++op)
+  {
+    switch(op->code)
+    {
+      case OP_TEXT:
+        out_put(op->text, op->len);
+        break;
+
+      case OP_NAME:
+        out_str(filename);
+        break;
+
+      case OP_QNAME:
+        out_put("\"", 1);
+        out_str(filename);
+        out_put("\"", 1);
+
+        if(((info->mode & S_IFMT) == S_IFLNK)
+           && ((count = readlink(filename, buf, sizeof(buf))) >= 0))
+        {
+          out_put(" -> \"", 5);
+          out_put(buf, count);
+          out_put("\"", 1);
+        }
+        break;
+
+      case OP_SIZE:
+        out_num(info->size, 10);
+        break;
+
+      case OP_BLOCKS:
+        out_num(info->blocks, 10);
+        break;
+
+      case OP_RAWMODE:
+        out_num(info->mode, 16);
+        break;
+
+      case OP_OCTMODE:
+        out_num(info->mode & 07777, 8);
+        break;
+
+      case OP_MODE:
+        mode_string(info->mode, buf);
+        out_put(buf, 10);
+        break;
+
+      case OP_TYPE:
+        out_str(type_name(info->mode));
+        break;
+
+      case OP_LINKS:
+        out_num(info->nlink, 10);
+        break;
+
+      case OP_UID:
+        out_num(info->uid, 10);
+        break;
+
+      case OP_USER:
+        out_str(idcache_name(&users, info->uid, FALSE));
+        break;
+
+      case OP_GID:
+        out_num(info->gid, 10);
+        break;
+
+      case OP_GROUP:
+        out_str(idcache_name(&groups, info->gid, TRUE));
+        break;
+
+      case OP_INODE:
+        out_num(info->ino, 10);
+        break;
+
+      case OP_DEV:
+        out_num(info->dev_major, 10);
+        out_put(",", 1);
+        out_num(info->dev_minor, 10);
+        break;
+
+      case OP_RDEV:
+        out_num(info->rdev_major, 10);
+        out_put(",", 1);
+        out_num(info->rdev_minor, 10);
+        break;
+
+      case OP_MOUNT:
+        if(info->have & WANT_MNT_ID)
+          out_num(info->mnt_id, 10);
+        else
+          out_put("-", 1);
+        break;
+
+      case OP_ATIME:
+        out_time(info->atime);
+        break;
+
+      case OP_MTIME:
+        out_time(info->mtime);
+        break;
+
+      case OP_CTIME:
+        out_time(info->ctime);
+        break;
+
+      case OP_BTIME:
+        if(info->have & STATX_BTIME)
+          out_time(info->btime);
+        else
+          out_put("-", 1);
+        break;
+
+      case OP_ATIME_SEC:
+        out_signed(info->atime);
+        break;
+
+      case OP_MTIME_SEC:
+        out_signed(info->mtime);
+        break;
+
+      case OP_CTIME_SEC:
+        out_signed(info->ctime);
+        break;
+
+      case OP_BTIME_SEC:
+        out_signed((info->have & STATX_BTIME) ? info->btime : 0);
+        break;
+    }
+  }
+
+  out_put("\n", 1);
+
+  if(olen >= OUTBUFSZ)
+    out_flush();
+}
+
+static void dostat(const char *filename, const info_t *info);
 static void tsince(long time_sec);
 
+/* Print the information about a file, or the reason there is none.
+ */
+
+static void show(const char *filename, c_bool_t ok, const info_t *info)
+{
+  if(! ok)
+  {
+    /* keep the error in its place among the output */
+
+    out_flush();
+    fflush(stdout);
+    C_error_printf("Can't lstat %s\n", filename);
+  }
+  else if(format)
+    format_file(filename, info);
+  else
+    dostat(filename, info);
+
+  if(! format)
+    putchar('\n');
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/* Claim and examine files until there are none left, staying no more than
+ * AHEAD files ahead of the output.
+ */
+
+static void *pool_work(void *arg)
+{
+  pool_t *pool = (pool_t *)arg;
+  size_t i, first, last;
+  result_t *r;
+
+  for(;;)
+  {
+    pthread_mutex_lock(&(pool->lock));
+
+    while((pool->next < pool->count)
+          && (pool->next >= pool->printed + AHEAD))
+      pthread_cond_wait(&(pool->room), &(pool->lock));
+
+    first = pool->next;
+    last = first + BATCH;
+    if(last > pool->count)
+      last = pool->count;
+    if(last > pool->printed + AHEAD)
+      last = pool->printed + AHEAD;
+    pool->next = last;
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    if(first >= last)
+      break;
+
+    for(i = first; i < last; ++i)
+    {
+      r = &(pool->results[i % AHEAD]);
+      r->ok = getinfo(pool->files[i], want, &(r->info));
+
+      pthread_mutex_lock(&(pool->lock));
+      r->done = TRUE;
+      pthread_cond_signal(&(pool->ready));
+      pthread_mutex_unlock(&(pool->lock));
+    }
+  }
+
+  return(NULL);
+}
+
+/* Examine files on the given number of threads, and print them in order
+ * as their results come in.
+ */
+
+static void stat_parallel(char **files, size_t count, int jobs)
+{
+  pool_t pool;
+  pthread_t *threads = C_newa(jobs, pthread_t);
+  size_t i;
+  int j;
+  result_t *r;
+
+  pool.files = files;
+  pool.count = count;
+  pool.next = 0;
+  pool.printed = 0;
+  pool.results = C_newa(AHEAD, result_t);
+  pthread_mutex_init(&(pool.lock), NULL);
+  pthread_cond_init(&(pool.ready), NULL);
+  pthread_cond_init(&(pool.room), NULL);
+
+  for(j = 0; j < jobs; ++j)
+    pthread_create(&(threads[j]), NULL, pool_work, &pool);
+
+  for(i = 0; i < count; ++i)
+  {
+    r = &(pool.results[i % AHEAD]);
+
+    pthread_mutex_lock(&(pool.lock));
+    while(! r->done)
+      pthread_cond_wait(&(pool.ready), &(pool.lock));
+    pthread_mutex_unlock(&(pool.lock));
+
+    show(files[i], r->ok, &(r->info));
+
+    pthread_mutex_lock(&(pool.lock));
+    r->done = FALSE;
+    pool.printed = i + 1;
+    pthread_cond_broadcast(&(pool.room));
+    pthread_mutex_unlock(&(pool.lock));
+  }
+
+  for(j = 0; j < jobs; ++j)
+    pthread_join(threads[j], NULL);
+
+  pthread_cond_destroy(&(pool.room));
+  pthread_cond_destroy(&(pool.ready));
+  pthread_mutex_destroy(&(pool.lock));
+  C_free(pool.results);
+  C_free(threads);
+}
+
+#endif /* HAVE_LIBPTHREAD */
+
 /*
  */
 
 int main(int argc, char **argv)
 {
-  int fct, ch, x;
-  c_bool_t errflag = FALSE, **p;
+  int fct, ch, x, jobs = 1;
+  c_bool_t errflag = FALSE, ok;
+  char **p;
+  info_t info;
 
   C_error_init(*argv);
     
-  while((ch = getopt(argc, argv, "h")) != EOF)
+  while((ch = getopt(argc, argv, "c:ehj:")) != EOF)
     switch((char)ch)
     {
+      case 'c':
+        format = optarg;
+        break;
+
+      case 'e':
+        extended = TRUE;
+        want |= STATX_BTIME | WANT_MNT_ID;
+        break;
+
       case 'h':
         C_error_printf("%s\n", HEADER);
         C_error_usage(USAGE);
         exit(EXIT_SUCCESS);
 
+      case 'j':
+        jobs = atoi(optarg);
+        if(jobs < 1 || jobs > MAX_JOBS)
+        {
+          C_error_printf("Number of jobs must be between 1 and %i\n",
+                         MAX_JOBS);
+          errflag = TRUE;
+        }
+        break;
+
       default:
         errflag = TRUE;
     }
@@ -134,11 +1045,28 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  for(x = fct, p = &(argv[optind]); x--; p++)
+  if(format && ! compile_format(format))
+    exit(EXIT_FAILURE);
+
+#ifdef HAVE_LIBPTHREAD
+  if((jobs > 1) && (fct > 1))
   {
-    dostat(*p);
-    putchar('\n');
+    if(jobs > fct)
+      jobs = fct;
+
+    stat_parallel(&(argv[optind]), fct, jobs);
+  }
+  else
+#endif
+  {
+    for(x = fct, p = &(argv[optind]); x--; p++)
+    {
+      ok = getinfo(*p, want, &info);
+      show(*p, ok, &info);
+    }
   }
+
+  out_flush();
   
   return(EXIT_SUCCESS);
 }
@@ -146,25 +1074,16 @@ int main(int argc, char **argv)
 /*
  */
 
-static void dostat(const char *filename)
+static void dostat(const char *filename, const info_t *info)
 {
   int count;
-  struct passwd *pwent;
-  struct group *grent;
-  struct stat stbuf;
-  char mode[11] = "----------";
+  char mode[11];
   char linkbuf[LINKBUFSZ];
-  char *user, *group;
+  const char *user, *group;
 
   /* name */
   
-  if(lstat(filename, &stbuf) < 0)
-  {
-    C_error_printf("Can't lstat %s\n", filename);
-    return;
-  }
-
-  if((stbuf.st_mode & S_IFMT) == S_IFLNK)
+  if((info->mode & S_IFMT) == S_IFLNK)
   {
     if((count = readlink(filename, linkbuf, LINKBUFSZ)) < 0)
     {
@@ -184,183 +1103,106 @@ static void dostat(const char *filename)
   /* size */
 
 #if (SIZEOF_OFF_T == 8)
-  printf("  Size: %-10lld", (long long)stbuf.st_size);
+  printf("  Size: %-10lld", (long long)info->size);
 #else
-  printf("  Size: %-10ld", stbuf.st_size);
+  printf("  Size: %-10ld", (long)info->size);
 #endif
   
   /* type */
-  
-  printf("               Type: ");
 
-  switch(stbuf.st_mode & S_IFMT)
-  {
-    case S_IFDIR:       
-      printf("Directory\n");
-      break;
-    case S_IFCHR:       
-      printf("Character Device\n");
-      break;
-    case S_IFBLK:       
-      printf("Block Device\n");
-      break;
-    case S_IFREG:       
-      printf("Regular File\n");
-      break;
-    case S_IFLNK:       
-      printf("Symbolic Link\n");
-      break;
-    case S_IFSOCK:      
-      printf("Socket\n");
-      break;
-#ifdef S_IFDOOR
-    case S_IFDOOR:
-      printf("Door\n");
-      break;
-#endif
-    case S_IFIFO:       
-      printf("Fifo (Named Pipe)\n");
-      break;
-    default             :       
-      printf("Unknown\n");
-  }
+  printf("               Type: %s\n", type_name(info->mode));
 
   /* mode */
 
-  if(stbuf.st_mode & (S_IEXEC >> 6)) /* Other execute */
-    mode[9] = 'x';
-  if(stbuf.st_mode & (S_IWRITE >> 6)) /* Other write */
-    mode[8] = 'w';
-  if(stbuf.st_mode & (S_IREAD >> 6)) /* Other read */
-    mode[7] = 'r';
-  if(stbuf.st_mode & (S_IEXEC >> 3)) /* Group execute */
-    mode[6] = 'x';
-  if(stbuf.st_mode & (S_IWRITE >> 3)) /* Group write */
-    mode[5] = 'w';
-  if(stbuf.st_mode & (S_IREAD >> 3)) /* Group read */
-    mode[4] = 'r';
-  if(stbuf.st_mode & S_IEXEC) /* User execute */
-    mode[3] = 'x';
-  if(stbuf.st_mode & S_IWRITE) /* User write */
-    mode[2] = 'w';
-  if(stbuf.st_mode & S_IREAD) /* User read */
-    mode[1] = 'r';
-  if(stbuf.st_mode & S_ISVTX) /* Sticky bit */
-    mode[9] = 't';
-  if(stbuf.st_mode & S_ISGID) /* Set group id */
-    mode[6] = 's';
-  if(stbuf.st_mode & S_ISUID) /* Set user id */
-    mode[3] = 's';
-
-  switch(stbuf.st_mode & S_IFMT)
-  {
-    case S_IFDIR:       
-      mode[0] = 'd';
-      break;
-      
-    case S_IFCHR:       
-      mode[0] = 'c';
-      break;
-      
-    case S_IFBLK:       
-      mode[0] = 'b';
-      break;
-      
-    case S_IFREG:       
-      mode[0] = '-';
-      break;
-
-    case S_IFLNK:       
-      mode[0] = 'l';
-      break;
-
-    case S_IFSOCK:      
-      mode[0] = 's';
-      break;
-
-    case S_IFIFO:       
-      mode[0] = 'p';
-      break;
-
-#ifdef S_IFDOOR
-    case S_IFDOOR:
-      mode[0] = 'D';
-      break;
-#endif
+  mode_string(info->mode, mode);
 
-    default:    
-      mode[0] = '?';
-  }
-  
-  printf("  Mode: %04lo/%s", (long)(stbuf.st_mode & 07777), mode);
+  printf("  Mode: %04lo/%s", (long)(info->mode & 07777), mode);
 
   /* links */
 
-  printf("         Links: %-5ld\n", (long)stbuf.st_nlink);
+  printf("         Links: %-5ld\n", (long)info->nlink);
   
   /* UID */
   
-  setpwent();
-  pwent = getpwuid(stbuf.st_uid);
-  endpwent();
-
-  user = (pwent ? pwent->pw_name : "?");
+  user = idcache_name(&users, info->uid, FALSE);
   
-  printf("   UID: %5d/%-8s", (int)stbuf.st_uid, user);
+  printf("   UID: %5d/%-8s", (int)info->uid, user);
 
   /* inode */
 
 #if (SIZEOF_INO_T == 8)
-  printf("         I-Node: %-10lld\n", (long long)stbuf.st_ino);
+  printf("         I-Node: %-10lld\n", (long long)info->ino);
 #else
-  printf("         I-Node: %-10ld\n", (long)stbuf.st_ino);
+  printf("         I-Node: %-10ld\n", (long)info->ino);
 #endif
 
   /* GID */
   
-  setgrent();
-  grent = getgrgid(stbuf.st_gid);
-  endgrent();
-
-  group = (grent ? grent->gr_name : "?");
+  group = idcache_name(&groups, info->gid, TRUE);
 
-  printf("   GID: %5ld/%-8s", (long)stbuf.st_gid, group);
+  printf("   GID: %5ld/%-8s", (long)info->gid, group);
 
   /* device */
   
-  printf("         Device: %ld,%ld", (long)major(stbuf.st_dev),
-         (long)minor(stbuf.st_dev));
+  printf("         Device: %lu,%lu", info->dev_major, info->dev_minor);
 
-#ifdef HAVE_ST_RDEV
   /* only meaningful if file is device */
 
-  if(((stbuf.st_mode & S_IFMT) == S_IFCHR)
-     || ((stbuf.st_mode & S_IFMT) == S_IFBLK))
-    printf(" (Type: %ld,%ld)\n", (long)major(stbuf.st_rdev),
-           (long)minor(stbuf.st_rdev));
+  if(((info->mode & S_IFMT) == S_IFCHR)
+     || ((info->mode & S_IFMT) == S_IFBLK))
+    printf(" (Type: %lu,%lu)\n", info->rdev_major, info->rdev_minor);
   else
     putchar('\n');
-#endif
 
 #ifdef SINCE
   /* The %.24s strips the newline from the ctime() string */
 
-  printf("Access: %.24s", ctime(&(stbuf.st_atime)));
-  tsince(stbuf.st_atime);
+  printf("Access: %.24s", ctime(&(info->atime)));
+  tsince(info->atime);
 
-  printf("Modify: %.24s", ctime(&(stbuf.st_mtime)));
-  tsince(stbuf.st_mtime);
+  printf("Modify: %.24s", ctime(&(info->mtime)));
+  tsince(info->mtime);
 
-  printf("Change: %.24s", ctime(&(stbuf.st_ctime)));
-  tsince(stbuf.st_ctime);
+  printf("Change: %.24s", ctime(&(info->ctime)));
+  tsince(info->ctime);
+
+  if(extended)
+  {
+    if(info->have & STATX_BTIME)
+    {
+      printf(" Birth: %.24s", ctime(&(info->btime)));
+      tsince(info->btime);
+    }
+    else
+      printf(" Birth: -\n");
+  }
 
 #else /* SINCE */
 
-  printf("Access: %s", ctime(&(stbuf.st_atime)));
-  printf("Modify: %s", ctime(&(stbuf.st_mtime)));
-  printf("Change: %s", ctime(&(stbuf.st_ctime)));
+  printf("Access: %s", ctime(&(info->atime)));
+  printf("Modify: %s", ctime(&(info->mtime)));
+  printf("Change: %s", ctime(&(info->ctime)));
+
+  if(extended)
+  {
+    if(info->have & STATX_BTIME)
+      printf(" Birth: %s", ctime(&(info->btime)));
+    else
+      printf(" Birth: -\n");
+  }
 
 #endif /* SINCE */
+
+  if(extended)
+  {
+    if(info->have & WANT_MNT_ID)
+      printf(" Mount: %-10llu", info->mnt_id);
+    else
+      printf(" Mount: %-10s", "-");
+
+    printf("              Attrs: ");
+    put_attrs(info);
+  }
 }
 
 /* end of source file */
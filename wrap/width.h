@@ -0,0 +1,39 @@
+/* ----------------------------------------------------------------------------
+   wrap - word wrap text
+   Copyright (C) 1994-2025  Mark A Lindner
+
+   This file is part of misctools.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.
+   ----------------------------------------------------------------------------
+*/
+
+#ifndef __WRAP_WIDTH_H
+#define __WRAP_WIDTH_H
+
+extern const unsigned char width_index[];
+extern const unsigned char width_blocks[][64];
+
+/* display width (0, 1 or 2 columns) of code point CP, which must be less
+ * than 0x110000
+ */
+
+#define CP_WIDTH(CP)                                                  \
+  ((width_blocks[width_index[(CP) >> 8]][((CP) & 0xFF) >> 2]            \
+    >> (((CP) & 3) << 1)) & 3)
+
+#endif /* __WRAP_WIDTH_H */
+
+/* end of header file */
@@ -27,50 +27,1151 @@
 /* --- System Headers --- */
 
 #include <stdio.h>
-#include <ctype.h>
+#include <string.h>
+#include <limits.h>
 
-/* --- Local Headers --- */
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <cbase/cbase.h>
 
+/* --- Local Headers --- */
+
+#include "width.h"
+
 /* --- Macros --- */
 
 #define HEADER "wrap v" VERSION " - Mark Lindner"
-#define USAGE "[ -h ] [ -w width ]"
+#define USAGE "[ -h ] [ -o ] [ -p ] [ -j jobs ] [ -w width ]"
 
 #define DFL_WIDTH 78
-#define MAX_WIDTH 200
 #define MIN_WIDTH 10
 
+#define TABSTOP 8
+
+#define INBUFSZ (1024 * 1024)  /* input block size */
+#define OUTBUFSZ (256 * 1024)  /* output is written once this much is queued */
+#define CHUNKSZ (4 * 1024 * 1024) /* minimum size of a chunk in parallel mode */
+#define MAX_JOBS 256
+
+/* whitespace, as classified by isspace() in the C locale */
+
+#define IS_SPACE(C) (((C) == ' ')                                   \
+                     || ((unsigned)((unsigned char)(C) - '\t') < 5))
+
+/* --- Types --- */
+
+/* The words of the current paragraph, collected for optimal filling, along
+ * with scratch space for the line breaking computation.
+ */
+
+typedef struct
+{
+  char *text;    /* the words, concatenated */
+  size_t tlen;
+  size_t tcap;
+  size_t *off;   /* offset of each word in text */
+  int *wid;      /* width of each word */
+  size_t n;      /* number of words */
+  size_t cap;
+  double *pos;   /* pos[j]: width of words 0..j-1, each plus a space */
+  double *cost;  /* cost[j]: least cost of setting words 0..j-1 */
+  size_t *prev;  /* prev[j]: start of the last line in that setting */
+  size_t *queue; /* candidate line starts */
+  size_t scap;
+} para_t;
+
+/* The formatter state. Input is fed to it in blocks of any size, and output
+ * is accumulated in a buffer that the caller drains.
+ */
+
+typedef struct
+{
+  int width;
+  int avail;    /* columns available after the paragraph's prefix */
+  char *wbuf;   /* current word */
+  size_t wb;    /* length of current word, in bytes */
+  size_t wcap;  /* size of word buffer */
+  int wl;       /* width of current word, in columns */
+  int ll;       /* width of current output line, in columns */
+  char prevc;   /* last input character */
+  char *obuf;   /* pending output */
+  size_t olen;
+  size_t ocap;
+  c_bool_t optimal;
+  para_t para;
+  c_bool_t prefixes;   /* preserve indentation and comment prefixes */
+  char *pfx;           /* prefix of the current paragraph */
+  size_t pl;
+  char *lpfx;          /* prefix of the current input line */
+  size_t lpl;
+  size_t pcap;         /* size of each prefix buffer */
+  c_bool_t at_bol;     /* scanning the prefix of an input line */
+  c_bool_t slash;      /* a '/' that may begin a '//' prefix is pending */
+  c_bool_t in_para;
+  c_bool_t owe_prefix; /* the prefix is yet to be written on this line */
+  c_bool_t line_open;  /* the current output line is not empty */
+} wrapper_t;
+
 /* --- Functions --- */
 
+static void out_reserve(wrapper_t *w, size_t n)
+{
+  if(w->olen + n > w->ocap)
+  {
+    while(w->olen + n > w->ocap)
+      w->ocap = (w->ocap ? w->ocap * 2 : OUTBUFSZ);
+    w->obuf = C_realloc(w->obuf, w->ocap, char);
+  }
+}
+
+/*
+ */
+
+static void out_char(wrapper_t *w, char c)
+{
+  out_reserve(w, 1);
+  w->obuf[w->olen++] = c;
+}
+
+/*
+ */
+
+static void out_newline(wrapper_t *w)
+{
+  out_char(w, '\n');
+  w->owe_prefix = (w->pl > 0);
+  w->line_open = FALSE;
+}
+
+/*
+ */
+
+static void out_prefix(wrapper_t *w)
+{
+  if(w->owe_prefix)
+  {
+    out_reserve(w, w->pl);
+    memcpy(w->obuf + w->olen, w->pfx, w->pl);
+    w->olen += w->pl;
+    w->owe_prefix = FALSE;
+  }
+
+  w->line_open = TRUE;
+}
+
+/*
+ */
+
+static void out_word(wrapper_t *w, c_bool_t space)
+{
+  out_prefix(w);
+  out_reserve(w, w->wb + 1);
+  if(space)
+    w->obuf[w->olen++] = ' ';
+  memcpy(w->obuf + w->olen, w->wbuf, w->wb);
+  w->olen += w->wb;
+}
+
+/*
+ */
+
+static void word_append(wrapper_t *w, const char *p, size_t n)
+{
+  if(w->wb + n > w->wcap)
+  {
+    while(w->wb + n > w->wcap)
+      w->wcap *= 2;
+    w->wbuf = C_realloc(w->wbuf, w->wcap, char);
+  }
+
+  memcpy(w->wbuf + w->wb, p, n);
+  w->wb += n;
+}
+
+/* Write out the full word followed by the character at p (n bytes) that
+ * didn't fit, on a line of its own.
+ */
+
+static void para_flush(wrapper_t *w);
+
+static void dump_word(wrapper_t *w, const char *p, size_t n)
+{
+  if(w->optimal)
+    para_flush(w);
+
+  if(!w->prefixes || w->line_open)
+    out_newline(w);
+  out_word(w, FALSE);
+  out_reserve(w, n);
+  memcpy(w->obuf + w->olen, p, n);
+  w->olen += n;
+  out_newline(w);
+  w->ll = w->wl = 0;
+  w->wb = 0;
+}
+
+/* Decode the UTF-8 sequence at the start of the n bytes at p, returning its
+ * length and storing its display width in *cw. Malformed and truncated
+ * sequences are treated as a single byte of width 1, so that non-UTF-8 text
+ * is formatted as it always was.
+ */
+
+static size_t decode_utf8(const char *p, size_t n, int *cw)
+{
+  const unsigned char *u = (const unsigned char *)p;
+  unsigned long cp;
+  size_t len, i;
+
+  *cw = 1;
+
+  if(u[0] < 0xC2)
+    return(1);
+  else if(u[0] < 0xE0)
+    len = 2, cp = u[0] & 0x1F;
+  else if(u[0] < 0xF0)
+    len = 3, cp = u[0] & 0x0F;
+  else if(u[0] < 0xF5)
+    len = 4, cp = u[0] & 0x07;
+  else
+    return(1);
+
+  if(len > n)
+    return(1);
+
+  for(i = 1; i < len; ++i)
+  {
+    if((u[i] & 0xC0) != 0x80)
+      return(1);
+    cp = (cp << 6) | (u[i] & 0x3F);
+  }
+
+  /* reject overlong forms, surrogates and out-of-range values */
+
+  if(((len == 3) && (cp < 0x800)) || ((len == 4) && (cp < 0x10000))
+     || ((cp >= 0xD800) && (cp <= 0xDFFF)) || (cp > 0x10FFFF))
+    return(1);
+
+  *cw = CP_WIDTH(cp);
+  return(len);
+}
+
+/* Return the number of bytes at the end of the n bytes at p that form the
+ * start of an incomplete UTF-8 sequence.
+ */
+
+static size_t utf8_tail(const char *p, size_t n)
+{
+  size_t i;
+
+  for(i = 1; (i <= 3) && (i <= n); ++i)
+  {
+    unsigned char c = (unsigned char)p[n - i];
+
+    if((c & 0xC0) == 0x80)
+      continue;
+
+    if(((c >= 0xC2) && (c < 0xE0) && (i < 2))
+       || ((c >= 0xE0) && (c < 0xF0) && (i < 3))
+       || ((c >= 0xF0) && (c < 0xF5) && (i < 4)))
+      return(i);
+
+    break;
+  }
+
+  return(0);
+}
+
+/* Return the length of the run of non-whitespace characters at the start of
+ * the n bytes at p, and whether the run is entirely ASCII.
+ */
+
+static size_t scan_word(const char *p, size_t n, c_bool_t *ascii)
+{
+  size_t i = 0;
+  unsigned char hi = 0;
+
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  const __m128i four = _mm_set1_epi8(4);
+
+  for(; i + 16 <= n; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i t = _mm_sub_epi8(v, tab);
+    /* \t through \r map to 0..4 after subtracting \t */
+    __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                              _mm_cmpeq_epi8(_mm_min_epu8(t, four), t));
+    int mask = _mm_movemask_epi8(ws);
+    /* the sign bits are the bytes with the high bit set */
+    int high = _mm_movemask_epi8(v);
+
+    if(mask)
+    {
+      int k = __builtin_ctz(mask);
+
+      if(high & ((1 << k) - 1))
+        hi = 0x80;
+
+      *ascii = !hi;
+      return(i + k);
+    }
+
+    if(high)
+      hi = 0x80;
+  }
+#endif
+
+  for(; i < n && !IS_SPACE(p[i]); ++i)
+    hi |= (unsigned char)p[i];
+
+  *ascii = !(hi & 0x80);
+  return(i);
+}
+
+/* Add the current word to the paragraph.
+ */
+
+static void para_add_word(wrapper_t *w)
+{
+  para_t *pp = &(w->para);
+
+  if(pp->n == pp->cap)
+  {
+    pp->cap = (pp->cap ? pp->cap * 2 : 256);
+    pp->off = C_realloc(pp->off, pp->cap, size_t);
+    pp->wid = C_realloc(pp->wid, pp->cap, int);
+  }
+
+  if(pp->tlen + w->wb > pp->tcap)
+  {
+    while(pp->tlen + w->wb > pp->tcap)
+      pp->tcap = (pp->tcap ? pp->tcap * 2 : 4096);
+    pp->text = C_realloc(pp->text, pp->tcap, char);
+  }
+
+  pp->off[pp->n] = pp->tlen;
+  pp->wid[pp->n++] = w->wl;
+  memcpy(pp->text + pp->tlen, w->wbuf, w->wb);
+  pp->tlen += w->wb;
+  w->wl = 0, w->wb = 0;
+}
+
+/* Return the least x = pos[j] at which starting the last line at word b
+ * costs no more than starting it at word a < b. Because the cost of a line
+ * is the square of its slack, the difference between the two is linear in
+ * x; and once the line from a no longer fits, b wins outright.
+ */
+
+static double crossover(const para_t *pp, int width, size_t a, size_t b)
+{
+  double x = ((pp->cost[b] - pp->cost[a]) / (2.0 * (pp->pos[b] - pp->pos[a])))
+    + ((pp->pos[a] + pp->pos[b]) / 2.0) + width + 1;
+  double overfull = pp->pos[a] + width + 2;
+
+  return((x < overfull) ? x : overfull);
+}
+
+/* Set the paragraph with the least total raggedness: the sum, over all but
+ * the last line, of the square of the number of unused columns. This cost
+ * satisfies the quadrangle inequality, so a later candidate line start that
+ * overtakes an earlier one stays ahead; candidates are thus kept in a
+ * monotone queue ordered by their crossover points, each of which is
+ * computed in constant time, for a total running time that is linear in the
+ * number of words.
+ */
+
+static void para_flush(wrapper_t *w)
+{
+  para_t *pp = &(w->para);
+  size_t n = pp->n, i, j, head = 0, tail = 0, best, nlines;
+  double slack;
+
+  if(n == 0)
+    return;
+
+  if(n + 1 > pp->scap)
+  {
+    pp->scap = n + 1;
+    pp->pos = C_realloc(pp->pos, pp->scap, double);
+    pp->cost = C_realloc(pp->cost, pp->scap, double);
+    pp->prev = C_realloc(pp->prev, pp->scap, size_t);
+    pp->queue = C_realloc(pp->queue, pp->scap, size_t);
+  }
+
+  pp->pos[0] = 0;
+  for(j = 0; j < n; ++j)
+    pp->pos[j + 1] = pp->pos[j] + pp->wid[j] + 1;
+
+  pp->cost[0] = 0;
+  pp->queue[tail++] = 0;
+
+  for(j = 1; j < n; ++j)
+  {
+    while((tail - head > 1)
+          && (crossover(pp, w->avail, pp->queue[head], pp->queue[head + 1])
+              <= pp->pos[j]))
+      ++head;
+
+    i = pp->queue[head];
+    slack = w->avail - (pp->pos[j] - pp->pos[i] - 1);
+    pp->cost[j] = pp->cost[i] + (slack * slack);
+    pp->prev[j] = i;
+
+    while((tail - head > 1)
+          && (crossover(pp, w->avail, pp->queue[tail - 2], pp->queue[tail - 1])
+              >= crossover(pp, w->avail, pp->queue[tail - 1], j)))
+      --tail;
+
+    pp->queue[tail++] = j;
+  }
+
+  /* the last line costs nothing, as long as it fits */
+
+  best = n - 1;
+  for(i = n - 1; i-- > 0 && (pp->pos[n] - pp->pos[i] - 1 <= w->avail);)
+  {
+    if(pp->cost[i] < pp->cost[best])
+      best = i;
+  }
+
+  /* recover the line starts, last to first, then write out the lines */
+
+  nlines = 0;
+  for(i = best; ; i = pp->prev[i])
+  {
+    pp->queue[nlines++] = i;
+    if(i == 0)
+      break;
+  }
+
+  while(nlines--)
+  {
+    size_t start = pp->queue[nlines];
+    size_t end = ((nlines > 0) ? pp->queue[nlines - 1] : n), len;
+
+    len = ((end < n) ? pp->off[end] : pp->tlen) - pp->off[start];
+    out_prefix(w);
+    out_reserve(w, len + (end - start));
+
+    for(i = start; i < end; ++i)
+    {
+      size_t wend = ((i + 1 < n) ? pp->off[i + 1] : pp->tlen);
+
+      if(i > start)
+        w->obuf[w->olen++] = ' ';
+      memcpy(w->obuf + w->olen, pp->text + pp->off[i], wend - pp->off[i]);
+      w->olen += wend - pp->off[i];
+    }
+
+    if(nlines > 0)
+      out_newline(w);
+    else
+      w->ll = (int)(pp->pos[n] - pp->pos[start] - 1);
+  }
+
+  pp->n = 0;
+  pp->tlen = 0;
+}
+
+/* Place the current word, which has just been terminated by whitespace.
+ */
+
+static void end_word(wrapper_t *w)
+{
+  if(w->optimal)
+    para_add_word(w);
+  else if((w->ll + w->wl + (w->ll > 0)) <= w->avail)
+  {
+    out_word(w, (w->ll > 0));
+    w->ll += w->wl + (w->ll > 0);
+    w->wl = 0, w->wb = 0;
+  }
+  else
+  {
+    out_newline(w);
+    out_word(w, FALSE);
+    w->ll = w->wl;
+    w->wl = 0, w->wb = 0;
+  }
+}
+
+/* End the current paragraph, if there is one.
+ */
+
+static void end_para(wrapper_t *w)
+{
+  if(w->optimal)
+    para_flush(w);
+
+  if(w->line_open)
+    out_newline(w);
+
+  w->owe_prefix = FALSE;
+  w->in_para = FALSE;
+  w->ll = 0;
+}
+
+/*
+ */
+
+static void prefix_append(wrapper_t *w, const char *p, size_t n)
+{
+  if(w->lpl + n > w->pcap)
+  {
+    while(w->lpl + n > w->pcap)
+      w->pcap *= 2;
+    w->pfx = C_realloc(w->pfx, w->pcap, char);
+    w->lpfx = C_realloc(w->lpfx, w->pcap, char);
+  }
+
+  memcpy(w->lpfx + w->lpl, p, n);
+  w->lpl += n;
+}
+
+static void wrap_block(wrapper_t *w, const char *p, size_t n);
+
+/* The prefix of an input line has been scanned, up to the character c. A
+ * line that consists of nothing but its prefix separates paragraphs, and is
+ * copied to the output (less any trailing whitespace); a line whose prefix
+ * differs from that of the previous line starts a new paragraph. Returns
+ * TRUE if c was consumed.
+ */
+
+static c_bool_t end_prefix(wrapper_t *w, char c)
+{
+  c_bool_t slash = w->slash;
+
+  w->slash = FALSE;
+
+  if((c == '\n') && !slash)
+  {
+    size_t len = w->lpl;
+
+    end_para(w);
+    while(len > 0 && IS_SPACE(w->lpfx[len - 1]))
+      --len;
+
+    out_reserve(w, len + 1);
+    memcpy(w->obuf + w->olen, w->lpfx, len);
+    w->olen += len;
+    w->obuf[w->olen++] = '\n';
+    w->lpl = 0;
+    return(TRUE);
+  }
+
+  if(!w->in_para || (w->lpl != w->pl) || memcmp(w->lpfx, w->pfx, w->pl))
+  {
+    size_t i;
+    int col = 0;
+
+    end_para(w);
+    memcpy(w->pfx, w->lpfx, w->lpl);
+    w->pl = w->lpl;
+
+    for(i = 0; i < w->pl; ++i)
+      col = ((w->pfx[i] == '\t') ? ((col / TABSTOP) + 1) * TABSTOP : col + 1);
+
+    w->avail = w->width - col;
+    if(w->avail < MIN_WIDTH)
+      w->avail = MIN_WIDTH;
+
+    w->in_para = TRUE;
+    w->owe_prefix = (w->pl > 0);
+  }
+
+  w->at_bol = FALSE;
+
+  /* a lone '/' is part of the text */
+
+  if(slash)
+    wrap_block(w, "/", 1);
+
+  return(FALSE);
+}
+
+/* Scan the prefix at the start of an input line: leading whitespace,
+ * followed by any number of comment or quotation markers ('#', '//' or
+ * '>'), each optionally followed by whitespace. Returns a pointer to the
+ * first character that was not consumed.
+ */
+
+static const char *scan_prefix(wrapper_t *w, const char *p, const char *end)
+{
+  for(; p < end; ++p)
+  {
+    char c = *p;
+
+    if(c == '/')
+    {
+      if(w->slash || (w->lpl > 0 && w->lpfx[w->lpl - 1] == '/'))
+      {
+        if(w->slash)
+          prefix_append(w, "/", 1);
+        prefix_append(w, "/", 1);
+        w->slash = FALSE;
+      }
+      else
+        w->slash = TRUE;
+    }
+    else if(!w->slash && ((c == ' ') || (c == '\t') || (c == '#')
+                          || (c == '>')))
+      prefix_append(w, p, 1);
+    else
+    {
+      if(end_prefix(w, c))
+        ++p;
+      break;
+    }
+  }
+
+  return(p);
+}
+
+/* Process a block of input. This is the classic byte-at-a-time greedy
+ * algorithm, except that runs of word characters are located and copied in
+ * bulk.
+ */
+
+static void wrap_block(wrapper_t *w, const char *p, size_t n)
+{
+  const char *end = p + n;
+
+  while(p < end)
+  {
+    char c = *p;
+
+    if(w->at_bol)
+    {
+      p = scan_prefix(w, p, end);
+      continue;
+    }
+
+    if(!IS_SPACE(c))
+    {
+      c_bool_t ascii;
+      size_t run = scan_word(p, end - p, &ascii);
+
+      w->prevc = p[run - 1];
+
+      if(ascii)
+      {
+        /* fast path: one column per byte */
+
+        while(run > 0)
+        {
+          size_t k = w->avail - w->wl;
+
+          if(k > run)
+            k = run;
+
+          word_append(w, p, k);
+          w->wl += k, p += k, run -= k;
+
+          if(run > 0) /* word is full so we gotta dump it */
+          {
+            dump_word(w, p, 1);
+            ++p, --run;
+          }
+        }
+      }
+      else
+      {
+        while(run > 0)
+        {
+          int cw;
+          size_t k = decode_utf8(p, run, &cw);
+
+          if(w->wl + cw <= w->avail)
+          {
+            word_append(w, p, k);
+            w->wl += cw;
+          }
+          else /* word is full so we gotta dump it */
+            dump_word(w, p, k);
+
+          p += k, run -= k;
+        }
+      }
+    }
+    else
+    {
+      if(w->prefixes)
+      {
+        /* line breaks are just word breaks; paragraphs are delimited by
+         * prefix-only lines instead
+         */
+
+        if(w->wb)
+          end_word(w);
+        if(c == '\n')
+          w->at_bol = TRUE, w->lpl = 0;
+      }
+      else if(w->prevc == '\n')
+      {
+        if(c == '\n')
+        {
+          if(w->optimal)
+            para_flush(w);
+          w->ll = 0;
+          out_reserve(w, 2);
+          w->obuf[w->olen++] = '\n';
+          w->obuf[w->olen++] = '\n';
+        }
+        else if(w->ll > 0)
+          w->ll++;
+      }
+      else if(w->wb)
+        end_word(w);
+
+      w->prevc = c;
+      ++p;
+    }
+  }
+}
+
+/* Flush whatever is left in the word buffer at end of input.
+ */
+
+static void wrap_finish(wrapper_t *w)
+{
+  if(w->prefixes)
+  {
+    /* a last line that ends partway through its prefix is a prefix-only
+     * line, unless a lone '/' makes it text
+     */
+
+    if(w->slash)
+      end_prefix(w, 0);
+    else if(w->at_bol && (w->lpl > 0))
+      end_prefix(w, '\n');
+
+    if(w->wb)
+      end_word(w);
+    end_para(w);
+  }
+  else if(w->optimal)
+  {
+    if(w->wb)
+      para_add_word(w);
+    para_flush(w);
+  }
+  else if(w->wb)
+  {
+    if((w->ll + w->wl + (w->ll > 0)) <= w->avail)
+      out_word(w, (w->ll > 0));
+    else
+    {
+      out_newline(w);
+      out_word(w, FALSE);
+    }
+  }
+
+  if(!w->prefixes)
+    out_char(w, '\n');
+}
+
+/*
+ */
+
+static void wrapper_init(wrapper_t *w, int width, c_bool_t optimal,
+                         c_bool_t prefixes)
+{
+  memset(w, 0, sizeof(wrapper_t));
+  w->width = w->avail = width;
+  w->optimal = optimal;
+  w->prefixes = prefixes;
+  w->wcap = 256;
+  w->wbuf = C_malloc(w->wcap, char);
+  w->pcap = 64;
+  w->pfx = C_malloc(w->pcap, char);
+  w->lpfx = C_malloc(w->pcap, char);
+  w->at_bol = prefixes;
+  w->ocap = OUTBUFSZ * 2;
+  w->obuf = C_malloc(w->ocap, char);
+}
+
+/*
+ */
+
+static void wrapper_free(wrapper_t *w)
+{
+  C_free(w->obuf);
+  C_free(w->wbuf);
+  C_free(w->pfx);
+  C_free(w->lpfx);
+  C_free(w->para.text);
+  C_free(w->para.off);
+  C_free(w->para.wid);
+  C_free(w->para.pos);
+  C_free(w->para.cost);
+  C_free(w->para.prev);
+  C_free(w->para.queue);
+}
+
+/*
+ */
+
+static c_bool_t drain(wrapper_t *w)
+{
+  c_bool_t ok = (fwrite(w->obuf, 1, w->olen, stdout) == w->olen);
+
+  w->olen = 0;
+  return(ok);
+}
+
+/*
+ */
+
+static c_bool_t wrap_serial(wrapper_t *w)
+{
+  char *ibuf = C_malloc(INBUFSZ, char);
+  size_t n, held = 0;
+  c_bool_t ok = TRUE;
+
+  while(ok && ((n = fread(ibuf + held, 1, INBUFSZ - held, stdin)) > 0))
+  {
+    /* hold back a UTF-8 sequence that is split across blocks */
+
+    n += held;
+    held = utf8_tail(ibuf, n);
+    wrap_block(w, ibuf, n - held);
+    memmove(ibuf, ibuf + n - held, held);
+
+    if(w->olen >= OUTBUFSZ)
+      ok = drain(w);
+  }
+
+  wrap_block(w, ibuf, held);
+  wrap_finish(w);
+  if(ok)
+    ok = drain(w);
+
+  C_free(ibuf);
+  return(ok);
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/* In parallel mode, the input is cut into chunks just after a pair of
+ * newlines. At such a point the formatter is always in the same state (at
+ * the start of a paragraph, with an empty line and word), whatever the mode,
+ * so each chunk can be formatted independently by a fresh formatter and the
+ * results concatenated to give exactly the serial output.
+ */
+
+typedef enum { SLOT_FREE, SLOT_READY, SLOT_BUSY, SLOT_DONE } slot_state_t;
+
+typedef struct
+{
+  slot_state_t state;
+  char *in;
+  size_t inlen;
+  size_t incap;
+  char *out;
+  size_t outlen;
+  size_t outcap;
+  c_bool_t first;
+  c_bool_t last;
+} slot_t;
+
+typedef struct
+{
+  const wrapper_t *proto; /* formatting options */
+  slot_t *slots;
+  size_t nslots;
+  unsigned long nread;    /* chunks read so far */
+  unsigned long nproc;    /* chunks handed to workers so far */
+  c_bool_t eof;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;   /* a chunk is ready to be formatted */
+  pthread_cond_t done;    /* a chunk has been formatted */
+} pool_t;
+
+/*
+ */
+
+static void *wrap_worker(void *arg)
+{
+  pool_t *pool = (pool_t *)arg;
+  wrapper_t w;
+
+  wrapper_init(&w, pool->proto->width, pool->proto->optimal,
+               pool->proto->prefixes);
+
+  for(;;)
+  {
+    slot_t *slot;
+    char *t;
+    size_t tc;
+
+    pthread_mutex_lock(&(pool->lock));
+    while((pool->nproc == pool->nread) && !pool->eof)
+      pthread_cond_wait(&(pool->ready), &(pool->lock));
+
+    if(pool->nproc == pool->nread)
+    {
+      pthread_mutex_unlock(&(pool->lock));
+      break;
+    }
+
+    slot = &(pool->slots[pool->nproc++ % pool->nslots]);
+    slot->state = SLOT_BUSY;
+    pthread_mutex_unlock(&(pool->lock));
+
+    /* start from the state at a paragraph boundary */
+
+    w.wl = w.ll = 0;
+    w.wb = 0;
+    w.prevc = (slot->first ? 0 : '\n');
+    w.avail = w.width;
+    w.pl = w.lpl = 0;
+    w.at_bol = w.prefixes;
+    w.slash = w.in_para = w.owe_prefix = w.line_open = FALSE;
+
+    wrap_block(&w, slot->in, slot->inlen);
+    if(slot->last)
+      wrap_finish(&w);
+
+    /* trade output buffers with the slot */
+
+    t = slot->out, tc = slot->outcap;
+    slot->out = w.obuf, slot->outcap = w.ocap, slot->outlen = w.olen;
+    w.obuf = t, w.ocap = tc, w.olen = 0;
+
+    pthread_mutex_lock(&(pool->lock));
+    slot->state = SLOT_DONE;
+    pthread_cond_broadcast(&(pool->done));
+    pthread_mutex_unlock(&(pool->lock));
+  }
+
+  wrapper_free(&w);
+  return(NULL);
+}
+
+/* Return the offset just past the last pair of newlines in the n bytes at
+ * p, or 0 if there is none.
+ */
+
+static size_t last_break(const char *p, size_t n)
+{
+  while(n > 1)
+  {
+    if(p[n - 1] == '\n' && p[n - 2] == '\n')
+      return(n);
+    --n;
+  }
+
+  return(0);
+}
+
+/* Read the next chunk of input into slot, leaving any input beyond the
+ * last paragraph break in carry for the next chunk.
+ */
+
+static void read_chunk(slot_t *slot, char **carry, size_t *clen,
+                       size_t *ccap, c_bool_t *eof)
+{
+  size_t cut = 0, scanned = 0, n;
+
+  /* the carried-over input becomes the start of this chunk */
+
+  char *t = slot->in;
+  size_t tc = slot->incap;
+
+  slot->in = *carry, slot->incap = *ccap, slot->inlen = *clen;
+  *carry = t, *ccap = tc, *clen = 0;
+
+  while(!*eof)
+  {
+    if(slot->inlen > scanned)
+    {
+      size_t from = (scanned > 0 ? scanned - 1 : 0);
+      size_t k = last_break(slot->in + from, slot->inlen - from);
+
+      if(k)
+        cut = from + k;
+      scanned = slot->inlen;
+    }
+
+    if(cut && (slot->inlen >= CHUNKSZ))
+      break;
+
+    if(slot->incap - slot->inlen < INBUFSZ)
+    {
+      slot->incap = ((slot->incap > INBUFSZ) ? slot->incap * 2 : INBUFSZ * 2);
+      slot->in = C_realloc(slot->in, slot->incap, char);
+    }
+
+    n = fread(slot->in + slot->inlen, 1, INBUFSZ, stdin);
+    if(n == 0)
+      *eof = TRUE;
+    slot->inlen += n;
+  }
+
+  if(*eof)
+    cut = slot->inlen;
+
+  /* move whatever follows the break to the carry buffer */
+
+  n = slot->inlen - cut;
+  if(n > *ccap)
+  {
+    *ccap = n;
+    *carry = C_realloc(*carry, *ccap, char);
+  }
+  memcpy(*carry, slot->in + cut, n);
+  *clen = n;
+  slot->inlen = cut;
+  slot->last = *eof;
+}
+
+/* Format the input on nthreads worker threads, while the main thread reads
+ * chunks and writes out the formatted chunks in order.
+ */
+
+static c_bool_t wrap_parallel(wrapper_t *w, int nthreads)
+{
+  pool_t pool;
+  pthread_t *threads = C_newa(nthreads, pthread_t);
+  unsigned long nwritten = 0;
+  char *carry = NULL;
+  size_t clen = 0, ccap = 0, i;
+  c_bool_t eof = FALSE, ok = TRUE;
+  int t, nt;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.proto = w;
+  pool.nslots = nthreads * 2;
+  pool.slots = C_newa(pool.nslots, slot_t);
+  pthread_mutex_init(&(pool.lock), NULL);
+  pthread_cond_init(&(pool.ready), NULL);
+  pthread_cond_init(&(pool.done), NULL);
+
+  for(nt = 0; nt < nthreads; ++nt)
+  {
+    if(pthread_create(&(threads[nt]), NULL, wrap_worker, &pool) != 0)
+      break;
+  }
+
+  if(nt == 0)
+  {
+    /* couldn't start any threads */
+
+    C_free(pool.slots);
+    C_free(threads);
+    return(wrap_serial(w));
+  }
+
+  while(!eof || (nwritten < pool.nread))
+  {
+    slot_t *slot;
+
+    if(!eof && (pool.nread - nwritten < pool.nslots))
+    {
+      slot = &(pool.slots[pool.nread % pool.nslots]);
+      slot->first = (pool.nread == 0);
+      read_chunk(slot, &carry, &clen, &ccap, &eof);
+
+      pthread_mutex_lock(&(pool.lock));
+      slot->state = SLOT_READY;
+      pool.nread++;
+      pool.eof = eof;
+      pthread_cond_broadcast(&(pool.ready));
+      pthread_mutex_unlock(&(pool.lock));
+      continue;
+    }
+
+    slot = &(pool.slots[nwritten % pool.nslots]);
+
+    pthread_mutex_lock(&(pool.lock));
+    while(slot->state != SLOT_DONE)
+      pthread_cond_wait(&(pool.done), &(pool.lock));
+    pthread_mutex_unlock(&(pool.lock));
+
+    if(ok && (fwrite(slot->out, 1, slot->outlen, stdout) != slot->outlen))
+      ok = FALSE;
+
+    slot->state = SLOT_FREE;
+    ++nwritten;
+  }
+
+  for(t = 0; t < nt; ++t)
+    pthread_join(threads[t], NULL);
+
+  for(i = 0; i < pool.nslots; ++i)
+  {
+    C_free(pool.slots[i].in);
+    C_free(pool.slots[i].out);
+  }
+
+  pthread_mutex_destroy(&(pool.lock));
+  pthread_cond_destroy(&(pool.ready));
+  pthread_cond_destroy(&(pool.done));
+  C_free(pool.slots);
+  C_free(threads);
+  C_free(carry);
+
+  return(ok);
+}
+
+#endif /* HAVE_LIBPTHREAD */
+
+/*
+ */
+
 int main(int argc, char **argv)
 {
-  char *wbuf = C_newstr(DFL_WIDTH + 1), *wp = wbuf, prevc = 0;
-  c_bool_t errf = FALSE;
-  int c, wl = 0, ll = 0, width = DFL_WIDTH;
+  wrapper_t w;
+  c_bool_t errf = FALSE, ok = TRUE, optimal = FALSE, prefixes = FALSE;
+  int c, width = DFL_WIDTH, jobs = 1;
+  long lw;
+  char *e;
   extern char *optarg;
 
   C_error_init(*argv);
 
-  while((c = getopt(argc, argv, "w:h")) != EOF)
+  while((c = getopt(argc, argv, "w:j:oph")) != EOF)
   {
     switch(c)
     {
+      case 'o':
+        optimal = TRUE;
+        break;
+
+      case 'p':
+        prefixes = TRUE;
+        break;
+
+      case 'j':
+        jobs = atoi(optarg);
+        if(jobs < 1 || jobs > MAX_JOBS)
+        {
+          C_error_printf("Number of jobs must be between 1 and %i\n",
+                         MAX_JOBS);
+          errf = TRUE;
+        }
+        break;
+
       case 'w':
-        width = atoi(optarg);
-        if(width < MIN_WIDTH || width > MAX_WIDTH)
+        lw = strtol(optarg, &e, 10);
+        if(*e || lw < MIN_WIDTH || lw > INT_MAX / 2)
         {
           C_error_printf("Width parameter out of range (defaulting to %i)\n",
                          DFL_WIDTH);
-          width = DFL_WIDTH;
+          lw = DFL_WIDTH;
         }
+        width = (int)lw;
         break;
 
       case 'h':
         C_error_printf("%s\n", HEADER);
         C_error_usage(USAGE);
-        C_free(wbuf);
         exit(EXIT_SUCCESS);
 
       default:
@@ -81,76 +1182,28 @@ int main(int argc, char **argv)
   if(errf)
   {
     C_error_usage(USAGE);
-    C_free(wbuf);
     exit(EXIT_FAILURE);
   }
 
   /* now do the actual formatting */
 
-  while((c = getchar()) != EOF)
-  {
-    if(!isspace(c))
-    {
-      if(wl < width)
-      {
-        *wp = (char)c;
-        wl++, wp++;
-      }
-      else /* word is full so we gotta dump it */
-      {
-        *wp = 0;
-        putchar('\n');
-        fputs(wbuf, stdout);
-        putchar(c);
-        putchar('\n');
-        wp = wbuf, ll = wl = 0;
-      }
-    }
-    else /* isspace(c) */
-    {
-      if(prevc == '\n')
-      {
-        if(prevc == '\n' && c == '\n')
-          ll = 0, putchar('\n'), putchar('\n');
-        else if(ll > 0)
-          ll++;
-      }
-      else if(wl && ((ll + wl + (ll > 0)) <= width))
-      {
-        *wp = 0;
-        if(ll)
-          putchar(' '), ll++;
-        fputs(wbuf, stdout);
-        ll += wl;
-        wl = 0, wp = wbuf;
-      }
-      else if(wl)
-      {
-        *wp = 0;
-        putchar('\n');
-        fputs(wbuf, stdout);
-        ll = wl;
-        wl = 0, wp = wbuf;
-      }
-    }
-    prevc = c;
-  }
-  /* if stuff is left in word buffer, need to deal with it */
+  wrapper_init(&w, width, optimal, prefixes);
 
-  if(wl)
-  {
-    *wp = 0;
-    if((ll + wl + (ll > 0)) <= width)
-    {
-      if(ll)
-        putchar(' ');
-    }
-    else putchar('\n');
-    fputs(wbuf, stdout);
-  }
-  putchar('\n');
-  C_free(wbuf);
-  exit(EXIT_SUCCESS);
+#ifdef HAVE_LIBPTHREAD
+  if(jobs > 1)
+    ok = wrap_parallel(&w, jobs);
+  else
+#endif
+    ok = wrap_serial(&w);
+
+  if(ok && fflush(stdout) != 0)
+    ok = FALSE;
+
+  if(!ok)
+    C_error_syserr();
+
+  wrapper_free(&w);
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 /* end of source file */